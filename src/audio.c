@@ -0,0 +1,118 @@
+/*
+; Lock-free single-producer/single-consumer audio ring buffer. The emulation side
+; writes samples into the ring, whereas the SDL audio callback drains it.
+;
+; The audio callback runs on SDL's audio thread, so nothing in the consumer path may
+; take a lock or allocate memory. Each side only ever writes to its own index and
+; publishes it with release semantics once the samples have been copied.
+*/
+
+#include <memory.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "util.h"
+#include "audio.h"
+
+// Write samples into the ring (producer only).
+uint32_t audio_ring_write(struct audio_ring* ring, const int16_t* samples, uint32_t count)
+{
+    // Work out how much free space there is. The tail is acquired so that the consumer
+    // is guaranteed to be done with the samples it has already read.
+    uint32_t head = ring->head;
+    uint32_t free_space = ring->capacity - (head - atomic_load_u32(&ring->tail));
+    if (count > free_space)
+    {
+        atomic_add_u32(&ring->overruns, 1);
+        count = free_space;
+    }
+
+    // Copy the samples in (in up to two parts, should the write wrap around).
+    uint32_t start = head & ring->mask;
+    uint32_t first = min(count, ring->capacity - start);
+    memcpy(&ring->samples[start], samples, first * sizeof(int16_t));
+    memcpy(ring->samples, samples + first, (count - first) * sizeof(int16_t));
+
+    // Publish the new head.
+    atomic_store_u32(&ring->head, head + count);
+    return count;
+}
+
+// Read samples from the ring (consumer only).
+uint32_t audio_ring_read(struct audio_ring* ring, int16_t* samples, uint32_t count)
+{
+    // Work out how many samples are available.
+    uint32_t tail = ring->tail;
+    uint32_t available = atomic_load_u32(&ring->head) - tail;
+    uint32_t read = min(count, available);
+
+    // Copy the samples out (in up to two parts, should the read wrap around).
+    uint32_t start = tail & ring->mask;
+    uint32_t first = min(read, ring->capacity - start);
+    memcpy(samples, &ring->samples[start], first * sizeof(int16_t));
+    memcpy(samples + first, ring->samples, (read - first) * sizeof(int16_t));
+    if (read)
+        ring->last_sample = samples[read - 1];
+
+    // Publish the new tail.
+    atomic_store_u32(&ring->tail, tail + read);
+
+    // Pad the rest of the buffer if the ring ran dry.
+    if (read < count)
+    {
+        atomic_add_u32(&ring->underruns, 1);
+        for (uint32_t i = read; i < count; ++i)
+            samples[i] = ring->last_sample;
+    }
+    return read;
+}
+
+// Return the number of samples currently queued in the ring.
+uint32_t audio_ring_fill(struct audio_ring* ring)
+{
+    return atomic_load_u32(&ring->head) - atomic_load_u32(&ring->tail);
+}
+
+// Return the factor by which the length of an emulated frame should be scaled.
+double audio_ring_rate_control(struct audio_ring* ring)
+{
+    // Map the fill level onto [-1, 1], where 0 is half full, and scale it down to the
+    // maximum rate delta. Keeping the correction this small means that the change in
+    // pitch (and frame rate) is inaudible, but it is still enough to soak up the
+    // drift between the host's audio and video clocks.
+    double fill = (double)audio_ring_fill(ring) / ring->capacity;
+    double error = min(max(fill * 2.0 - 1.0, -1.0), 1.0);
+    return 1.0 + error * AUDIO_MAX_RATE_DELTA;
+}
+
+// SDL audio callback.
+void audio_ring_callback(void* userdata, uint8_t* stream, int len)
+{
+    audio_ring_read((struct audio_ring*)userdata, (int16_t*)stream, (uint32_t)len / sizeof(int16_t));
+}
+
+// Create a new audio ring instance.
+struct audio_ring* audio_ring_alloc(uint32_t capacity)
+{
+    // Round the capacity up to a power of two.
+    uint32_t rounded = 1;
+    while (rounded < capacity)
+        rounded <<= 1;
+
+    // Allocate the ring and its sample buffer. As safe_malloc() uses calloc()
+    // internally, the indices and counters should already be set to zero.
+    struct audio_ring* ring = safe_malloc(sizeof(struct audio_ring));
+    ring->samples = safe_calloc(rounded, sizeof(int16_t));
+    ring->capacity = rounded;
+    ring->mask = rounded - 1;
+    return ring;
+}
+
+// Free an audio ring instance.
+void audio_ring_free(struct audio_ring* ring)
+{
+    if (ring == NULL)
+        return;
+    free(ring->samples);
+    free(ring);
+}
\ No newline at end of file
@@ -0,0 +1,63 @@
+/*
+; Lock-free single-producer/single-consumer audio ring buffer. The emulation side
+; writes samples into the ring, whereas the SDL audio callback drains it.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Assumed size of a cache line; keeps the producer/consumer indices apart.
+#define AUDIO_CACHE_LINE 64
+
+// Maximum deviation from the nominal emulation speed used for dynamic rate control.
+#define AUDIO_MAX_RATE_DELTA 0.005
+
+// Audio ring buffer struct definition.
+struct audio_ring
+{
+    // Sample buffer. The capacity is always a power of two, so that the free-running
+    // indices can simply be masked.
+    int16_t* samples;
+    uint32_t capacity;
+    uint32_t mask;
+
+    // Producer index; only ever written to by the emulation side.
+    uint8_t padding0[AUDIO_CACHE_LINE];
+    volatile uint32_t head;
+    volatile uint32_t overruns;     // Number of writes that had to drop samples.
+
+    // Consumer index; only ever written to by the audio callback.
+    uint8_t padding1[AUDIO_CACHE_LINE];
+    volatile uint32_t tail;
+    volatile uint32_t underruns;    // Number of reads that had to be padded.
+    int16_t last_sample;            // Repeated on underrun to avoid popping.
+    uint8_t padding2[AUDIO_CACHE_LINE];
+};
+
+// Write samples into the ring (producer only). Samples that do not fit are
+// dropped. Returns the number of samples written.
+uint32_t audio_ring_write(struct audio_ring* ring, const int16_t* samples, uint32_t count);
+
+// Read samples from the ring (consumer only). If the ring runs dry, the rest of the
+// buffer is padded with the last sample read. Returns the number of samples read.
+uint32_t audio_ring_read(struct audio_ring* ring, int16_t* samples, uint32_t count);
+
+// Return the number of samples currently queued in the ring.
+uint32_t audio_ring_fill(struct audio_ring* ring);
+
+// Return the factor by which the length of an emulated frame should be scaled, so
+// that the ring hovers around half full. This is always within AUDIO_MAX_RATE_DELTA
+// of 1: above 1 when the ring is filling up (slow down), below 1 when it is draining.
+double audio_ring_rate_control(struct audio_ring* ring);
+
+// SDL audio callback. The userdata must point to the audio ring; the stream is
+// expected to be in the AUDIO_S16SYS mono format.
+void audio_ring_callback(void* userdata, uint8_t* stream, int len);
+
+// Create a new audio ring instance. The capacity is rounded up to a power of two.
+struct audio_ring* audio_ring_alloc(uint32_t capacity);
+
+// Free an audio ring instance.
+void audio_ring_free(struct audio_ring* ring);
\ No newline at end of file
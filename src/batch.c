@@ -0,0 +1,154 @@
+/*
+; Lockstep batches.
+;
+; Before each frame, every lane is keyed by its state hash (see nes_hash()), which
+; leaves out the input. Lanes with a key already seen are checked against the lane
+; that has it, byte for byte, and follow that lane if they match; the rest lead.
+;
+; Only the leaders are emulated up front. A game only sees the input of a frame if it
+; latches the controllers during it, and most frames of most games do so at most
+; once, so if a leader didn't, its followers end up just where it did whatever their
+; input, and are cloned from it. Otherwise, each follower is cloned from the first
+; lane of its group that has been emulated with the same input, or emulated itself
+; if there is none.
+*/
+
+#include <memory.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <assert.h>
+
+#include "util.h"
+#include "batch.h"
+
+// Marks an empty slot of the grouping table.
+#define BATCH_EMPTY         0xFFFFFFFF
+
+// Check whether a lane has host output of its own.
+static bool has_output(const struct nes* lane)
+{
+    return lane->screen || lane->screen_indices || lane->trace;
+}
+
+// Find the lane that a lane can follow, or add it to the table as a leader.
+static uint32_t find_leader(struct batch* batch, uint32_t lane, uint64_t key)
+{
+    uint32_t mask = batch->table_size - 1;
+    for (uint32_t i = (uint32_t)key & mask;; i = (i + 1) & mask)
+    {
+        uint32_t other = batch->table[i];
+        if (other == BATCH_EMPTY)
+        {
+            batch->table[i] = lane;
+            batch->keys[i] = key;
+            return lane;
+        }
+        if (batch->keys[i] == key && !memcmp(&batch->lanes[other], &batch->lanes[lane], NES_STATE_SIZE))
+            return other;
+    }
+}
+
+// Emulate a lane with its own input.
+static void emulate(struct batch* batch, uint32_t lane, const uint8_t* inputs)
+{
+    struct nes* computer = &batch->lanes[lane];
+    computer->controllers[0].value = inputs[lane * 2 + 0];
+    computer->controllers[1].value = inputs[lane * 2 + 1];
+    computer->input_latched = false;
+    nes_frame(computer);
+    batch->emulated[lane] = true;
+    batch->emulated_frames++;
+}
+
+// Step every lane by a frame.
+void batch_step(struct batch* batch, const uint8_t* inputs)
+{
+    // Group the lanes. The input is left out of the comparison, as the lanes still
+    // hold the input of the last frame.
+    memset(batch->table, 0xFF, batch->table_size * sizeof(uint32_t));
+    for (uint32_t lane = 0; lane < batch->lane_count; ++lane)
+    {
+        struct nes* computer = &batch->lanes[lane];
+        computer->controllers[0].value = 0;
+        computer->controllers[1].value = 0;
+        batch->emulated[lane] = false;
+        if (has_output(computer))
+            batch->leaders[lane] = lane;
+        else
+            batch->leaders[lane] = find_leader(batch, lane, nes_hash(computer));
+    }
+
+    // Emulate the leaders.
+    for (uint32_t lane = 0; lane < batch->lane_count; ++lane)
+    {
+        if (batch->leaders[lane] == lane)
+            emulate(batch, lane, inputs);
+    }
+
+    // Bring the followers along: from the leader if it never saw its input, otherwise
+    // from a lane of the group emulated with the same input, if any.
+    for (uint32_t lane = 0; lane < batch->lane_count; ++lane)
+    {
+        uint32_t leader = batch->leaders[lane];
+        if (leader == lane)
+            continue;
+        uint32_t source = leader;
+        if (batch->lanes[leader].input_latched)
+        {
+            source = BATCH_EMPTY;
+            for (uint32_t other = leader; other < lane && source == BATCH_EMPTY; ++other)
+            {
+                if (batch->emulated[other] && batch->leaders[other] == leader
+                    && !memcmp(&inputs[other * 2], &inputs[lane * 2], 2))
+                    source = other;
+            }
+        }
+        if (source == BATCH_EMPTY)
+            emulate(batch, lane, inputs);
+        else
+        {
+            nes_clone(&batch->lanes[lane], &batch->lanes[source]);
+            batch->lanes[lane].controllers[0].value = inputs[lane * 2 + 0];
+            batch->lanes[lane].controllers[1].value = inputs[lane * 2 + 1];
+        }
+    }
+    batch->lane_frames += batch->lane_count;
+}
+
+// Create a new batch.
+struct batch* batch_alloc(struct cartridge* cartridge, uint32_t lane_count)
+{
+    assert(lane_count);
+    struct batch* batch = safe_malloc(sizeof(struct batch));
+    batch->lane_count = lane_count;
+    batch->lanes = safe_calloc(lane_count, sizeof(struct nes));
+    for (uint32_t lane = 0; lane < lane_count; ++lane)
+    {
+        nes_init(&batch->lanes[lane]);
+        nes_setcartridge(&batch->lanes[lane], cartridge);
+        nes_reset(&batch->lanes[lane]);
+    }
+    batch->table_size = 2;
+    while (batch->table_size < lane_count * 2)
+        batch->table_size <<= 1;
+    batch->leaders = safe_calloc(lane_count, sizeof(uint32_t));
+    batch->emulated = safe_calloc(lane_count, sizeof(bool));
+    batch->table = safe_calloc(batch->table_size, sizeof(uint32_t));
+    batch->keys = safe_calloc(batch->table_size, sizeof(uint64_t));
+    return batch;
+}
+
+// Free a batch.
+void batch_free(struct batch* batch)
+{
+    if (batch == NULL)
+        return;
+    for (uint32_t lane = 0; lane < batch->lane_count; ++lane)
+        nes_release(&batch->lanes[lane]);
+    free(batch->lanes);
+    free(batch->leaders);
+    free(batch->emulated);
+    free(batch->table);
+    free(batch->keys);
+    free(batch);
+}
\ No newline at end of file
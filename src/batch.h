@@ -0,0 +1,45 @@
+/*
+; Lockstep batches: a number of machines running the same cartridge, stepped one frame
+; at a time together with an input for each. Lanes that are in the same state are
+; emulated once, and the result copied to the rest, unless the game reads their
+; differing input; so batches whose lanes agree (title screens, cutscenes, frames
+; where the game ignores the input) cost far less than one machine per lane.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "nes.h"
+
+// Batch struct definition.
+struct batch
+{
+    struct nes* lanes;          // The machines, lane_count of them.
+    uint32_t lane_count;
+
+    // Lane grouping scratch: the first lane in the same state as each lane, whether
+    // each lane has been emulated this frame, and an open-addressed table of the
+    // groups, keyed by state hash.
+    uint32_t* leaders;
+    bool* emulated;
+    uint32_t* table;
+    uint64_t* keys;
+    uint32_t table_size;        // A power of two, at least twice lane_count.
+
+    // Statistics.
+    uint64_t lane_frames;       // Frames stepped, counting each lane.
+    uint64_t emulated_frames;   // Frames actually emulated.
+};
+
+// Step every lane by a frame. inputs holds two bytes (controller ports 0 and 1) for
+// each lane. Lanes with a screen, palette index buffer or trace attached always run
+// on their own, so that their output is their own.
+void batch_step(struct batch* batch, const uint8_t* inputs);
+
+// Create a new batch of lanes with the cartridge inserted, reset.
+struct batch* batch_alloc(struct cartridge* cartridge, uint32_t lane_count);
+
+// Free a batch, releasing its lanes.
+void batch_free(struct batch* batch);
\ No newline at end of file
@@ -10,6 +10,7 @@
 #include "util.h"
 #include "cartridge.h"
 #include "mappers_nrom.h"
+#include "profile.h"
 
 #define INES_MAGIC 0x1A53454E
 
@@ -66,29 +67,41 @@ enum mirror_type cartridge_mirror_type(struct cartridge* cartridge)
 // Read per CPU request.
 bool cartridge_cpu_read(struct cartridge* cartridge, uint16_t address, uint8_t* byte)
 {
-    return cartridge->mapper->cpu_read(cartridge->mapper, address, byte);
+    PROFILE_BEGIN(start);
+    bool mapped = cartridge->mapper->cpu_read(cartridge->mapper, address, byte);
+    PROFILE_END(start, PROFILE_MAPPER_READ);
+    return mapped;
 }
 
 // Write per CPU request.
 bool cartridge_cpu_write(struct cartridge* cartridge, uint16_t address, uint8_t byte)
 {
-    return cartridge->mapper->cpu_write(cartridge->mapper, address, byte);
+    PROFILE_BEGIN(start);
+    bool mapped = cartridge->mapper->cpu_write(cartridge->mapper, address, byte);
+    PROFILE_END(start, PROFILE_MAPPER_WRITE);
+    return mapped;
 }
 
 // Read per PPU request.
 bool cartridge_ppu_read(struct cartridge* cartridge, uint16_t address, uint8_t* byte)
 {
-    return cartridge->mapper->ppu_read(cartridge->mapper, address, byte);
+    PROFILE_BEGIN(start);
+    bool mapped = cartridge->mapper->ppu_read(cartridge->mapper, address, byte);
+    PROFILE_END(start, PROFILE_MAPPER_READ);
+    return mapped;
 }
 
 // Write per PPU request.
 bool cartridge_ppu_write(struct cartridge* cartridge, uint16_t address, uint8_t byte)
 {
-    return cartridge->mapper->ppu_write(cartridge->mapper, address, byte);
+    PROFILE_BEGIN(start);
+    bool mapped = cartridge->mapper->ppu_write(cartridge->mapper, address, byte);
+    PROFILE_END(start, PROFILE_MAPPER_WRITE);
+    return mapped;
 }
 
 // Create a new cartridge instance.
-struct cartridge* cartridge_alloc(uint8_t* ines_data, size_t ines_size)
+struct cartridge* cartridge_alloc(const uint8_t* ines_data, size_t ines_size)
 {
     // If the given size is smaller than the size of the header, we can't
     // even begin to read the header, so exit immediately.
@@ -99,8 +112,9 @@ struct cartridge* cartridge_alloc(uint8_t* ines_data, size_t ines_size)
     }
 
     // Allocate a new cartridge instance.
-    struct cartridge* cartridge = safe_malloc(sizeof(struct cartridge));
-    struct ines_header* header = (struct ines_header*)ines_data;
+    struct cartridge* cartridge = safe_calloc(1, sizeof(struct cartridge));
+    const struct ines_header* header = (const struct ines_header*)ines_data;
+    cartridge->refs = 1;
 
     // Validate the magic of the cartridge data.
     if (header->magic != INES_MAGIC)
@@ -122,14 +136,17 @@ struct cartridge* cartridge_alloc(uint8_t* ines_data, size_t ines_size)
         goto corrupt;
     }
 
-    // Read the PRG ROM.
-    cartridge->prg_rom = safe_malloc(cartridge->prg_rom_size);
-    memcpy(cartridge->prg_rom, ines_data + offset, cartridge->prg_rom_size);
+    // Without any CHR ROM, the cartridge would have CHR RAM instead.
+    if (cartridge->chr_rom_size == 0)
+    {
+        snprintf(error_msg, sizeof(error_msg), "CHR RAM is currently not supported");
+        goto corrupt;
+    }
 
-    // Read the CHR ROM.
+    // Point at the PRG ROM and CHR ROM in the image.
+    cartridge->prg_rom = ines_data + offset;
     offset += cartridge->prg_rom_size;
-    cartridge->chr_rom = safe_malloc(cartridge->chr_rom_size);
-    memcpy(cartridge->chr_rom, ines_data + offset, cartridge->chr_rom_size);
+    cartridge->chr_rom = ines_data + offset;
 
     // Set the cartridge's mirror type.
     cartridge->mirror_type = (enum mirror_type)header->mirror; 
@@ -159,15 +176,13 @@ corrupt:
     return NULL;
 }
 
-// Free a cartridge instance.
+// Drop a reference to a cartridge instance.
 void cartridge_free(struct cartridge* cartridge)
 {
-    if (cartridge == NULL)
+    if (cartridge == NULL || atomic_add_u32(&cartridge->refs, (uint32_t)-1) != 1)
         return;
     if (cartridge->mapper)
         cartridge->mapper->free(cartridge->mapper); // This is fine because &mapper->base = &mapper.
-    free(cartridge->prg_rom);
-    free(cartridge->chr_rom);
     free(cartridge);
 }
 
@@ -8,14 +8,16 @@
 #include <stdbool.h>
 
 #include "constants.h"
+#include "util.h"
 #include "mappers_base.h"
 
 // NES cartridge struct definition.
 struct cartridge
 {
-    // Program/character ROM buffers.
-    uint8_t* prg_rom;
-    uint8_t* chr_rom;
+    // Program/character ROM buffers. These point straight into the iNES image the
+    // cartridge was created from.
+    const uint8_t* prg_rom;
+    const uint8_t* chr_rom;
     size_t prg_rom_size;    // 16384 * x bytes
     size_t chr_rom_size;    // 8192 * y bytes
 
@@ -24,6 +26,13 @@ struct cartridge
 
     // Mapper.
     struct mapper* mapper;
+
+    // Number of references to the cartridge. A cartridge holds no state that changes
+    // as a game runs, so any number of NES computers can share one, even across
+    // threads; each holds a reference (see nes_setcartridge()). This holds for every
+    // mapper emulated so far. A mapper with bank registers or CHR RAM will have to
+    // keep them in the machine state instead.
+    volatile uint32_t refs;
 };
 
 // Return the current nametable mirroring used.
@@ -41,10 +50,20 @@ bool cartridge_ppu_read(struct cartridge* cartridge, uint16_t address, uint8_t*
 // Write per PPU request.
 bool cartridge_ppu_write(struct cartridge* cartridge, uint16_t address, uint8_t byte);
 
-// Create a new cartridge instance.
-struct cartridge* cartridge_alloc(uint8_t* ines_data, size_t ines_size);
+// Create a new cartridge instance. The PRG and CHR ROM are not copied, so the iNES
+// image (typically a read-only mapping of the file; see map_file()) must outlive the
+// cartridge.
+struct cartridge* cartridge_alloc(const uint8_t* ines_data, size_t ines_size);
+
+// Take another reference to a cartridge instance.
+inline struct cartridge* cartridge_retain(struct cartridge* cartridge)
+{
+    if (cartridge)
+        atomic_add_u32(&cartridge->refs, 1);
+    return cartridge;
+}
 
-// Free a cartridge instance.
+// Drop a reference to a cartridge instance, freeing it along with the last one.
 void cartridge_free(struct cartridge* cartridge);
 
 // Get the cartridge error message.
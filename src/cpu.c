@@ -9,11 +9,14 @@
 */
 
 #include <stdio.h>
+#include <memory.h>
 #include <stdint.h>
 #include <stdbool.h>
 
 #include "util.h"
 #include "cpu.h"
+#include "nes.h"
+#include "cpu_profile.h"
 
 // CPU interrupt vectors.
 #define NMI_VECTOR      0xFFFA
@@ -429,8 +432,8 @@ static bool addr_imm(struct cpu* cpu)
 // Absolute: fetch the value from address.
 static bool addr_abs(struct cpu* cpu)
 {
-    uint8_t lo = nes_read(cpu->computer, cpu->pc++);
-    uint8_t hi = nes_read(cpu->computer, cpu->pc++);
+    uint8_t lo = nes_read(cpu_nes(cpu), cpu->pc++);
+    uint8_t hi = nes_read(cpu_nes(cpu), cpu->pc++);
     cpu->addr_fetched = lo | (hi << 8);
     return false;
 }
@@ -438,8 +441,8 @@ static bool addr_abs(struct cpu* cpu)
 // Absolute X-indexed: fetch the value from address + Y.
 static bool addr_abs_x(struct cpu* cpu)
 {
-    uint8_t lo = nes_read(cpu->computer, cpu->pc++);
-    uint8_t hi = nes_read(cpu->computer, cpu->pc++);
+    uint8_t lo = nes_read(cpu_nes(cpu), cpu->pc++);
+    uint8_t hi = nes_read(cpu_nes(cpu), cpu->pc++);
     uint16_t addr = lo | (hi << 8);
     cpu->addr_fetched = addr + cpu->x;
     return ((addr & 0xFF) + cpu->x) > 0xFF;
@@ -448,8 +451,8 @@ static bool addr_abs_x(struct cpu* cpu)
 // Absolute Y-indexed: fetch the value from address + X.
 static bool addr_abs_y(struct cpu* cpu)
 {
-    uint8_t lo = nes_read(cpu->computer, cpu->pc++);
-    uint8_t hi = nes_read(cpu->computer, cpu->pc++);
+    uint8_t lo = nes_read(cpu_nes(cpu), cpu->pc++);
+    uint8_t hi = nes_read(cpu_nes(cpu), cpu->pc++);
     uint16_t addr = lo | (hi << 8);
     cpu->addr_fetched = addr + cpu->y;
     return ((addr & 0xFF) + cpu->y) > 0xFF;
@@ -458,21 +461,21 @@ static bool addr_abs_y(struct cpu* cpu)
 // Zero page: fetch the value from address & 0xFF.
 static bool addr_zpg(struct cpu* cpu)
 {
-    cpu->addr_fetched = nes_read(cpu->computer, cpu->pc++);
+    cpu->addr_fetched = nes_read(cpu_nes(cpu), cpu->pc++);
     return false;
 }
 
 // Zero page X-indexed: fetch the value from (address + X) & 0xFF.
 static bool addr_zpg_x(struct cpu* cpu)
 {
-    cpu->addr_fetched = (nes_read(cpu->computer, cpu->pc++) + cpu->x) & 0xFF;
+    cpu->addr_fetched = (nes_read(cpu_nes(cpu), cpu->pc++) + cpu->x) & 0xFF;
     return false;
 }
 
 // Zero page Y-indexed: fetch the value from (address + Y) & 0xFF.
 static bool addr_zpg_y(struct cpu* cpu)
 {
-    cpu->addr_fetched = (nes_read(cpu->computer, cpu->pc++) + cpu->y) & 0xFF;
+    cpu->addr_fetched = (nes_read(cpu_nes(cpu), cpu->pc++) + cpu->y) & 0xFF;
     return false;
 }
 
@@ -483,12 +486,12 @@ static bool addr_zpg_y(struct cpu* cpu)
 static bool addr_ind(struct cpu* cpu)
 {
     // Read the pointer.
-    uint8_t ptr_lo = nes_read(cpu->computer, cpu->pc++);
-    uint8_t ptr_hi = nes_read(cpu->computer, cpu->pc++);
+    uint8_t ptr_lo = nes_read(cpu_nes(cpu), cpu->pc++);
+    uint8_t ptr_hi = nes_read(cpu_nes(cpu), cpu->pc++);
 
     // Get the address at the pointer.
-    uint8_t lo = nes_read(cpu->computer, ptr_lo | (ptr_hi << 8));
-    uint8_t hi = nes_read(cpu->computer, ((ptr_lo + 1) & 0xFF) | (ptr_hi << 8));
+    uint8_t lo = nes_read(cpu_nes(cpu), ptr_lo | (ptr_hi << 8));
+    uint8_t hi = nes_read(cpu_nes(cpu), ((ptr_lo + 1) & 0xFF) | (ptr_hi << 8));
     cpu->addr_fetched = lo | (hi << 8);
     return false;
 }
@@ -497,11 +500,11 @@ static bool addr_ind(struct cpu* cpu)
 static bool addr_x_ind(struct cpu* cpu)
 {
     // Read the pointer.
-    uint8_t ptr = nes_read(cpu->computer, cpu->pc++) + cpu->x;
+    uint8_t ptr = nes_read(cpu_nes(cpu), cpu->pc++) + cpu->x;
 
     // Get the address at the pointer.
-    uint8_t lo = nes_read(cpu->computer, ptr & 0xFF);
-    uint8_t hi = nes_read(cpu->computer, (ptr + 1) & 0xFF);
+    uint8_t lo = nes_read(cpu_nes(cpu), ptr & 0xFF);
+    uint8_t hi = nes_read(cpu_nes(cpu), (ptr + 1) & 0xFF);
     cpu->addr_fetched = lo | (hi << 8);
     return false;
 }
@@ -510,11 +513,11 @@ static bool addr_x_ind(struct cpu* cpu)
 static bool addr_ind_y(struct cpu* cpu)
 {
     // Read the pointer.
-    uint8_t ptr = nes_read(cpu->computer, cpu->pc++);
+    uint8_t ptr = nes_read(cpu_nes(cpu), cpu->pc++);
 
     // Get the address at the pointer.
-    uint8_t lo = nes_read(cpu->computer, ptr);
-    uint8_t hi = nes_read(cpu->computer, (ptr + 1) & 0xFF);
+    uint8_t lo = nes_read(cpu_nes(cpu), ptr);
+    uint8_t hi = nes_read(cpu_nes(cpu), (ptr + 1) & 0xFF);
     uint16_t addr = lo | (hi << 8);
     cpu->addr_fetched = addr + cpu->y;
     return ((addr & 0xFF) + cpu->y) > 0xFF;
@@ -523,7 +526,7 @@ static bool addr_ind_y(struct cpu* cpu)
 // Relative: fetch the value from PC + signed imm8.
 static bool addr_rel(struct cpu* cpu)
 {
-    int8_t imm8 = nes_read(cpu->computer, cpu->pc++);
+    int8_t imm8 = nes_read(cpu_nes(cpu), cpu->pc++);
     cpu->addr_fetched = cpu->pc + imm8;
     return ((cpu->pc & 0xFF) + imm8) > 0xFF;
 }
@@ -546,20 +549,20 @@ static inline bool cpu_getflag(struct cpu* cpu, enum status_flags flag)
 // Push a byte onto the stack.
 static inline void cpu_push(struct cpu* cpu, uint8_t byte)
 {
-    nes_write(cpu->computer, 0x100 | (cpu->s--), byte);
+    nes_write(cpu_nes(cpu), 0x100 | (cpu->s--), byte);
 }
 
 // Pop a byte off the stack.
 static inline uint8_t cpu_pop(struct cpu* cpu)
 {
-    return nes_read(cpu->computer, 0x100 | (++cpu->s));
+    return nes_read(cpu_nes(cpu), 0x100 | (++cpu->s));
 }
 
 // ADC: add with carry (may take extra cycle if page crossed).
 static bool op_adc(struct cpu* cpu)
 {
     // Calculate the new accumulator value.
-    uint8_t memory = nes_read(cpu->computer, cpu->addr_fetched);
+    uint8_t memory = nes_read(cpu_nes(cpu), cpu->addr_fetched);
     uint16_t result = cpu->a + memory + cpu_getflag(cpu, CPUFLAG_C);
 
     // Calculate the new flags.
@@ -577,7 +580,7 @@ static bool op_adc(struct cpu* cpu)
 static bool op_and(struct cpu* cpu)
 {
     // Calculate the new accumulator value.
-    cpu->a &= nes_read(cpu->computer, cpu->addr_fetched);
+    cpu->a &= nes_read(cpu_nes(cpu), cpu->addr_fetched);
 
     // Calculate the new flags.
     cpu_setflag(cpu, CPUFLAG_Z, cpu->a == 0);
@@ -595,7 +598,7 @@ static bool op_asl(struct cpu* cpu)
     if (op_lookup[cpu->opcode].addr_mode == addr_a)
         memory = cpu->a;
     else
-        memory = nes_read(cpu->computer, cpu->addr_fetched);
+        memory = nes_read(cpu_nes(cpu), cpu->addr_fetched);
     uint8_t result = memory << 1;
 
     // Calculate the new flags.
@@ -612,8 +615,8 @@ static bool op_asl(struct cpu* cpu)
         // back to memory before the modified value. This distinction does
         // actually matter, because writing to addresses that are used by
         // hardware registers can trigger specific functions.
-        nes_write(cpu->computer, cpu->addr_fetched, memory);
-        nes_write(cpu->computer, cpu->addr_fetched, result);
+        nes_write(cpu_nes(cpu), cpu->addr_fetched, memory);
+        nes_write(cpu_nes(cpu), cpu->addr_fetched, result);
     }
     return false;
 }
@@ -664,7 +667,7 @@ static bool op_beq(struct cpu* cpu)
 static bool op_bit(struct cpu* cpu)
 {
     // Get the result of accumulator & memory.
-    uint8_t memory = nes_read(cpu->computer, cpu->addr_fetched);
+    uint8_t memory = nes_read(cpu_nes(cpu), cpu->addr_fetched);
     uint8_t result = cpu->a & memory;
 
     // Calculate the new flags.
@@ -803,7 +806,7 @@ static bool op_clv(struct cpu* cpu)
 static bool op_cmp(struct cpu* cpu)
 {
     // Get the result of accumulator - memory.
-    uint8_t memory = nes_read(cpu->computer, cpu->addr_fetched);
+    uint8_t memory = nes_read(cpu_nes(cpu), cpu->addr_fetched);
     uint8_t result = cpu->a - memory;
 
     // Calculate the new flags.
@@ -819,7 +822,7 @@ static bool op_cmp(struct cpu* cpu)
 static bool op_cpx(struct cpu* cpu)
 {
     // Get the result of accumulator - memory.
-    uint8_t memory = nes_read(cpu->computer, cpu->addr_fetched);
+    uint8_t memory = nes_read(cpu_nes(cpu), cpu->addr_fetched);
     uint8_t result = cpu->x - memory;
 
     // Calculate the new flags.
@@ -835,7 +838,7 @@ static bool op_cpx(struct cpu* cpu)
 static bool op_cpy(struct cpu* cpu)
 {
     // Get the result of accumulator - memory.
-    uint8_t memory = nes_read(cpu->computer, cpu->addr_fetched);
+    uint8_t memory = nes_read(cpu_nes(cpu), cpu->addr_fetched);
     uint8_t result = cpu->y - memory;
 
     // Calculate the new flags.
@@ -851,7 +854,7 @@ static bool op_cpy(struct cpu* cpu)
 static bool op_dec(struct cpu* cpu)
 {
     // Calculate the new value.
-    uint8_t memory = nes_read(cpu->computer, cpu->addr_fetched);
+    uint8_t memory = nes_read(cpu_nes(cpu), cpu->addr_fetched);
     uint8_t result = memory - 1;
 
     // Calculate the new flags.
@@ -859,8 +862,8 @@ static bool op_dec(struct cpu* cpu)
     cpu_setflag(cpu, CPUFLAG_N, result & 0x80);
 
     // Set the new value in the given memory location.
-    nes_write(cpu->computer, cpu->addr_fetched, memory);
-    nes_write(cpu->computer, cpu->addr_fetched, result);
+    nes_write(cpu_nes(cpu), cpu->addr_fetched, memory);
+    nes_write(cpu_nes(cpu), cpu->addr_fetched, result);
     return false;
 }
 
@@ -897,7 +900,7 @@ static bool op_dey(struct cpu* cpu)
 static bool op_eor(struct cpu* cpu)
 {
     // Calculate the new accumulator value.
-    cpu->a ^= nes_read(cpu->computer, cpu->addr_fetched);
+    cpu->a ^= nes_read(cpu_nes(cpu), cpu->addr_fetched);
 
     // Calculate the new flags.
     cpu_setflag(cpu, CPUFLAG_Z, cpu->a == 0);
@@ -911,7 +914,7 @@ static bool op_eor(struct cpu* cpu)
 static bool op_inc(struct cpu* cpu)
 {
     // Calculate the new value.
-    uint8_t memory = nes_read(cpu->computer, cpu->addr_fetched);
+    uint8_t memory = nes_read(cpu_nes(cpu), cpu->addr_fetched);
     uint8_t result = memory + 1;
 
     // Calculate the new flags.
@@ -919,8 +922,8 @@ static bool op_inc(struct cpu* cpu)
     cpu_setflag(cpu, CPUFLAG_N, result & 0x80);
 
     // Set the new value in the given memory location.
-    nes_write(cpu->computer, cpu->addr_fetched, memory);
-    nes_write(cpu->computer, cpu->addr_fetched, result);
+    nes_write(cpu_nes(cpu), cpu->addr_fetched, memory);
+    nes_write(cpu_nes(cpu), cpu->addr_fetched, result);
     return false;
 }
 
@@ -974,7 +977,7 @@ static bool op_jsr(struct cpu* cpu)
 static bool op_lda(struct cpu* cpu)
 {
     // Load the memory value into the accumulator.
-    cpu->a = nes_read(cpu->computer, cpu->addr_fetched);
+    cpu->a = nes_read(cpu_nes(cpu), cpu->addr_fetched);
 
     // Calculate the new flags.
     cpu_setflag(cpu, CPUFLAG_Z, cpu->a == 0);
@@ -989,7 +992,7 @@ static bool op_lda(struct cpu* cpu)
 static bool op_ldx(struct cpu* cpu)
 {
     // Load the memory value into the accumulator.
-    cpu->x = nes_read(cpu->computer, cpu->addr_fetched);
+    cpu->x = nes_read(cpu_nes(cpu), cpu->addr_fetched);
 
     // Calculate the new flags.
     cpu_setflag(cpu, CPUFLAG_Z, cpu->x == 0);
@@ -1004,7 +1007,7 @@ static bool op_ldx(struct cpu* cpu)
 static bool op_ldy(struct cpu* cpu)
 {
     // Load the memory value into the accumulator.
-    cpu->y = nes_read(cpu->computer, cpu->addr_fetched);
+    cpu->y = nes_read(cpu_nes(cpu), cpu->addr_fetched);
 
     // Calculate the new flags.
     cpu_setflag(cpu, CPUFLAG_Z, cpu->y == 0);
@@ -1022,7 +1025,7 @@ static bool op_lsr(struct cpu* cpu)
     if (op_lookup[cpu->opcode].addr_mode == addr_a)
         memory = cpu->a;
     else
-        memory = nes_read(cpu->computer, cpu->addr_fetched);
+        memory = nes_read(cpu_nes(cpu), cpu->addr_fetched);
     uint8_t result = memory >> 1;
 
     // Calculate the new flags.
@@ -1035,8 +1038,8 @@ static bool op_lsr(struct cpu* cpu)
         cpu->a = result;
     else
     {
-        nes_write(cpu->computer, cpu->addr_fetched, memory);
-        nes_write(cpu->computer, cpu->addr_fetched, result);
+        nes_write(cpu_nes(cpu), cpu->addr_fetched, memory);
+        nes_write(cpu_nes(cpu), cpu->addr_fetched, result);
     }
     return false;
 }
@@ -1051,7 +1054,7 @@ static bool op_nop(struct cpu* cpu)
 static bool op_ora(struct cpu* cpu)
 {
     // Calculate the new accumulator value.
-    cpu->a |= nes_read(cpu->computer, cpu->addr_fetched);
+    cpu->a |= nes_read(cpu_nes(cpu), cpu->addr_fetched);
 
     // Calculate the new flags.
     cpu_setflag(cpu, CPUFLAG_Z, cpu->a == 0);
@@ -1106,7 +1109,7 @@ static bool op_rol(struct cpu* cpu)
     if (op_lookup[cpu->opcode].addr_mode == addr_a)
         memory = cpu->a;
     else
-        memory = nes_read(cpu->computer, cpu->addr_fetched);
+        memory = nes_read(cpu_nes(cpu), cpu->addr_fetched);
     uint8_t result = (memory << 1) | cpu_getflag(cpu, CPUFLAG_C);
 
     // Calculate the new flags.
@@ -1119,8 +1122,8 @@ static bool op_rol(struct cpu* cpu)
         cpu->a = result;
     else
     {
-        nes_write(cpu->computer, cpu->addr_fetched, memory);
-        nes_write(cpu->computer, cpu->addr_fetched, result);
+        nes_write(cpu_nes(cpu), cpu->addr_fetched, memory);
+        nes_write(cpu_nes(cpu), cpu->addr_fetched, result);
     }
     return false;
 }
@@ -1133,7 +1136,7 @@ static bool op_ror(struct cpu* cpu)
     if (op_lookup[cpu->opcode].addr_mode == addr_a)
         memory = cpu->a;
     else
-        memory = nes_read(cpu->computer, cpu->addr_fetched);
+        memory = nes_read(cpu_nes(cpu), cpu->addr_fetched);
     uint8_t result = (memory >> 1) | (cpu_getflag(cpu, CPUFLAG_C) << 7);
 
     // Calculate the new flags.
@@ -1146,8 +1149,8 @@ static bool op_ror(struct cpu* cpu)
         cpu->a = result;
     else
     {
-        nes_write(cpu->computer, cpu->addr_fetched, memory);
-        nes_write(cpu->computer, cpu->addr_fetched, result);
+        nes_write(cpu_nes(cpu), cpu->addr_fetched, memory);
+        nes_write(cpu_nes(cpu), cpu->addr_fetched, result);
     }
     return false;
 }
@@ -1179,7 +1182,7 @@ static bool op_rts(struct cpu* cpu)
 static bool op_sbc(struct cpu* cpu)
 {
     // Calculate the new accumulator value.
-    uint8_t memory = ~nes_read(cpu->computer, cpu->addr_fetched);
+    uint8_t memory = ~nes_read(cpu_nes(cpu), cpu->addr_fetched);
     uint16_t result = cpu->a + memory + cpu_getflag(cpu, CPUFLAG_C);
 
     // Calculate the new flags.
@@ -1219,21 +1222,21 @@ static bool op_sei(struct cpu* cpu)
 // STA: store the accumulator into a given memory address.
 static bool op_sta(struct cpu* cpu)
 {
-    nes_write(cpu->computer, cpu->addr_fetched, cpu->a);
+    nes_write(cpu_nes(cpu), cpu->addr_fetched, cpu->a);
     return false;
 }
 
 // STA: store the X register into a given memory address.
 static bool op_stx(struct cpu* cpu)
 {
-    nes_write(cpu->computer, cpu->addr_fetched, cpu->x);
+    nes_write(cpu_nes(cpu), cpu->addr_fetched, cpu->x);
     return false;
 }
 
 // STA: store the Y register into a given memory address.
 static bool op_sty(struct cpu* cpu)
 {
-    nes_write(cpu->computer, cpu->addr_fetched, cpu->y);
+    nes_write(cpu_nes(cpu), cpu->addr_fetched, cpu->y);
     return false;
 }
 
@@ -1383,6 +1386,26 @@ void cpu_reset(struct cpu* cpu)
     cpu->cycles = 7;
 }
 
+// Record the instruction about to execute into the trace. The instruction bytes are
+// peeked rather than read, so that tracing has no effect on the emulation.
+static void cpu_trace(struct cpu* cpu)
+{
+    struct nes* computer = cpu_nes(cpu);
+    struct trace_record* record = trace_next(computer->trace);
+    record->cycle = cpu->enumerated_cycles - 1;
+    record->pc = cpu->pc;
+    record->opcode = nes_peek(computer, cpu->pc);
+    record->operands[0] = nes_peek(computer, cpu->pc + 1);
+    record->operands[1] = nes_peek(computer, cpu->pc + 2);
+    record->a = cpu->a;
+    record->x = cpu->x;
+    record->y = cpu->y;
+    record->p = cpu->p;
+    record->s = cpu->s;
+    record->scanline = computer->ppu.scanline;
+    record->dot = computer->ppu.cycle;
+}
+
 // Execute a CPU clock.
 void cpu_clock(struct cpu* cpu)
 {
@@ -1401,6 +1424,10 @@ void cpu_clock(struct cpu* cpu)
     if (!cpu->irq && cpu_getflag(cpu, CPUFLAG_I) == cpu->irq_toggle)
     {
         cpu_irq(cpu);
+#ifdef NES_PROFILE
+        if (cpu_nes(cpu)->profile && cpu->cycles)
+            cpu_profile_interrupt(cpu_nes(cpu)->profile, cpu->pc, cpu->cycles);
+#endif
         return;
     }
     cpu->irq_toggle = cpu_getflag(cpu, CPUFLAG_I);
@@ -1409,13 +1436,24 @@ void cpu_clock(struct cpu* cpu)
     if (!cpu->nmi && cpu->nmi_toggle != cpu->nmi)
     {
         cpu_nmi(cpu);
+#ifdef NES_PROFILE
+        if (cpu_nes(cpu)->profile)
+            cpu_profile_interrupt(cpu_nes(cpu)->profile, cpu->pc, cpu->cycles);
+#endif
         return;
     }
     cpu->nmi_toggle = cpu->nmi;
     
-    // Seems like we are ready to execute a new instruction. Read the given
-    // opcode data.
-    cpu->opcode = nes_read(cpu->computer, cpu->pc++);
+    // Seems like we are ready to execute a new instruction. Trace it as it stands, if
+    // tracing.
+    if (cpu_nes(cpu)->trace)
+        cpu_trace(cpu);
+
+    // Read the given opcode data.
+#ifdef NES_PROFILE
+    uint16_t pc = cpu->pc;
+#endif
+    cpu->opcode = nes_read(cpu_nes(cpu), cpu->pc++);
     assert(op_lookup[cpu->opcode].cycles);
     cpu->cycles = op_lookup[cpu->opcode].cycles - 1;
 
@@ -1427,34 +1465,38 @@ void cpu_clock(struct cpu* cpu)
     bool page_crossed = op_lookup[cpu->opcode].addr_mode(cpu);
     cpu->cycles += (page_crossed & op_lookup[cpu->opcode].op(cpu));
     assert(cpu->cycles < 7);
+
+    // Count the instruction, including this cycle.
+#ifdef NES_PROFILE
+    if (cpu_nes(cpu)->profile)
+        cpu_profile_instruction(cpu_nes(cpu)->profile, pc, cpu->opcode, cpu->cycles + 1, cpu->pc);
+#endif
 }
 
-// Create a new CPU instance. The CPU must be reset before used.
-struct cpu* cpu_alloc()
+// Initialize a CPU in place. The CPU must be reset before used.
+void cpu_init(struct cpu* cpu)
 {
-    struct cpu* cpu = safe_malloc(sizeof(struct cpu));
-    cpu->a = cpu->x = cpu->y = cpu->s = 0x00;
+    memset(cpu, 0, sizeof(struct cpu));
     cpu->p = 0b00100100;
     cpu->pc = RESET_VECTOR;
     cpu->irq = true;
     cpu->nmi = cpu->nmi_toggle = true;
-    return cpu;
 }
 
-// Free a CPU instance.
-void cpu_free(struct cpu* cpu)
+// Get the mnemonic of an opcode.
+const char* cpu_opcode_name(uint8_t opcode)
 {
-    free(cpu);
+    return op_lookup[opcode].name;
 }
 
-// Spew information on the current CPU status.
-void cpu_spew(struct cpu* cpu, uint16_t pc, FILE* stream)
+// Spew a trace record as a line of nestest-style text.
+void cpu_spew(const struct trace_record* record, FILE* stream)
 {
     // Print the PC and the bytes for the instruction.
-    fprintf(stream, "%04X  ", pc);
-    struct opcode op = op_lookup[nes_read(cpu->computer, pc)];
+    fprintf(stream, "%04X  ", record->pc);
+    struct opcode op = op_lookup[record->opcode];
     uint8_t bytes = 0;
-    if (op.addr_mode == addr_impl || op.addr_mode == addr_a)
+    if (op.addr_mode == addr_impl || op.addr_mode == addr_a || op.addr_mode == NULL)
         bytes = 1;
     else if (op.addr_mode == addr_imm || op.addr_mode == addr_zpg
         || op.addr_mode == addr_zpg_x || op.addr_mode == addr_zpg_y
@@ -1463,60 +1505,44 @@ void cpu_spew(struct cpu* cpu, uint16_t pc, FILE* stream)
         bytes = 2;
     else
         bytes = 3;
-    for (int i = 0; i < bytes; ++i)
-        fprintf(stream, "%02X ", nes_read(cpu->computer, pc + i));
+    fprintf(stream, "%02X ", record->opcode);
+    for (int i = 1; i < bytes; ++i)
+        fprintf(stream, "%02X ", record->operands[i - 1]);
     fprintf(stream, "%*s", (3 - bytes) * 3 + 1, "");
     
     // Print the opcode itself.
+    uint8_t lo = record->operands[0];
+    uint16_t address = record->operands[0] | (record->operands[1] << 8);
     fprintf(stream, "%s ", op.name);
-    if (op.addr_mode == addr_impl)
+    if (op.addr_mode == addr_impl || op.addr_mode == NULL)
         fprintf(stream, "                            ");
     else if (op.addr_mode == addr_a)
         fprintf(stream, "A                           ");
     else if (op.addr_mode == addr_imm)
-        fprintf(stream, "#$%02X                        ", nes_read(cpu->computer, pc + 1));
+        fprintf(stream, "#$%02X                        ", lo);
     else if (op.addr_mode == addr_abs)
-    {
-        uint8_t lo = nes_read(cpu->computer, pc + 1);
-        uint8_t hi = nes_read(cpu->computer, pc + 2);
-        fprintf(stream, "$%04X                       ", lo | (hi << 8));
-    }
+        fprintf(stream, "$%04X                       ", address);
     else if (op.addr_mode == addr_abs_x)
-    {
-        uint8_t lo = nes_read(cpu->computer, pc + 1);
-        uint8_t hi = nes_read(cpu->computer, pc + 2);
-        fprintf(stream, "$%04X,X                     ", lo | (hi << 8));
-    }
+        fprintf(stream, "$%04X,X                     ", address);
     else if (op.addr_mode == addr_abs_y)
-    {
-        uint8_t lo = nes_read(cpu->computer, pc + 1);
-        uint8_t hi = nes_read(cpu->computer, pc + 2);
-        fprintf(stream, "$%04X,Y                     ", lo | (hi << 8));
-    }
+        fprintf(stream, "$%04X,Y                     ", address);
     else if (op.addr_mode == addr_zpg)
-        fprintf(stream, "$%02X                         ", nes_read(cpu->computer, pc + 1));
+        fprintf(stream, "$%02X                         ", lo);
     else if (op.addr_mode == addr_zpg_x)
-        fprintf(stream, "$%02X,X                       ", nes_read(cpu->computer, pc + 1));
+        fprintf(stream, "$%02X,X                       ", lo);
     else if (op.addr_mode == addr_zpg_y)
-        fprintf(stream, "$%02X,Y                       ", nes_read(cpu->computer, pc + 1));
+        fprintf(stream, "$%02X,Y                       ", lo);
     else if (op.addr_mode == addr_ind)
-    {
-        uint8_t lo = nes_read(cpu->computer, pc + 1);
-        uint8_t hi = nes_read(cpu->computer, pc + 2);
-        fprintf(stream, "($%04X)                     ", lo | (hi << 8));
-    }
+        fprintf(stream, "($%04X)                     ", address);
     else if (op.addr_mode == addr_x_ind)
-        fprintf(stream, "($%02X,X)                     ", nes_read(cpu->computer, pc + 1));
+        fprintf(stream, "($%02X,X)                     ", lo);
     else if (op.addr_mode == addr_ind_y)
-        fprintf(stream, "($%02X),Y                     ", nes_read(cpu->computer, pc + 1));
+        fprintf(stream, "($%02X),Y                     ", lo);
     else if (op.addr_mode == addr_rel)
-    {
-        int8_t imm8 = nes_read(cpu->computer, pc + 1);
-        uint16_t address = pc + 2 + imm8;
-        fprintf(stream, "$%02X                       ", address);
-    }
+        fprintf(stream, "$%04X                       ", (uint16_t)(record->pc + 2 + (int8_t)lo));
 
     // Print register information.
-    fprintf(stream, "A:%02X X:%02X Y:%02X P:%02X SP:%02X             CYC:%llu\n", 
-        cpu->a, cpu->x, cpu->y, cpu->p, cpu->s, cpu->enumerated_cycles);
+    fprintf(stream, "A:%02X X:%02X Y:%02X P:%02X SP:%02X PPU:%3d,%3d CYC:%llu\n", 
+        record->a, record->x, record->y, record->p, record->s, record->scanline, record->dot,
+        (unsigned long long)record->cycle);
 }
\ No newline at end of file
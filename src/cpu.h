@@ -9,14 +9,14 @@
 #include <stdint.h>
 #include <stdbool.h>
 
-#include "nes.h"
+#include "trace.h"
+
+// Forward the NES computer struct.
+struct nes;
 
 // CPU struct definition.
 struct cpu
 {
-    // Bind the computer to the CPU.
-    struct nes* computer;
-
     // Registers.
     uint8_t a;              // Accumulator.
     uint8_t x;              // X index.
@@ -42,23 +42,17 @@ struct cpu
     uint64_t enumerated_cycles;
 };
 
-// Bind the computer to the CPU.
-inline void cpu_setnes(struct cpu* cpu, struct nes* computer)
-{
-    cpu->computer = computer;
-}
-
 // Reset the CPU.
 void cpu_reset(struct cpu* cpu);
 
 // Execute a CPU clock.
 void cpu_clock(struct cpu* cpu);
 
-// Create a new CPU instance. The CPU must be reset before used.
-struct cpu* cpu_alloc();
+// Initialize a CPU in place. The CPU must be reset before used.
+void cpu_init(struct cpu* cpu);
 
-// Free a CPU instance.
-void cpu_free(struct cpu* cpu);
+// Get the mnemonic of an opcode ("???" for illegal opcodes).
+const char* cpu_opcode_name(uint8_t opcode);
 
-// Spew information on the current CPU status.
-void cpu_spew(struct cpu* cpu, uint16_t pc, FILE* stream);
\ No newline at end of file
+// Spew a trace record as a line of nestest-style text.
+void cpu_spew(const struct trace_record* record, FILE* stream);
\ No newline at end of file
@@ -0,0 +1,154 @@
+/*
+; Game code profiler.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "util.h"
+#include "cpu.h"
+#include "cpu_profile.h"
+
+// Number of addresses listed in the text report.
+#define REPORT_HOT_ADDRESSES    48
+
+// Check whether an address is the start of a routine.
+static bool is_entry(const struct cpu_profile* profile, uint32_t pc)
+{
+    return profile->entry_points[pc >> 3] & (1 << (pc & 7));
+}
+
+// Find the start of the routine an address belongs to: the closest entry point at or
+// below it. Returns -1 if there is none.
+static int32_t routine_of(const struct cpu_profile* profile, uint32_t pc)
+{
+    for (int32_t i = pc; i >= 0; --i)
+        if (is_entry(profile, i))
+            return i;
+    return -1;
+}
+
+// Sort order for the hot address table: most cycles first.
+static const struct cpu_profile* sort_profile;
+static int compare_pc_cycles(const void* a, const void* b)
+{
+    uint64_t cycles_a = sort_profile->pc_cycles[*(const uint16_t*)a];
+    uint64_t cycles_b = sort_profile->pc_cycles[*(const uint16_t*)b];
+    return cycles_a < cycles_b ? 1 : cycles_a > cycles_b ? -1 : 0;
+}
+
+// Sort order for the opcode table: most cycles first.
+static int compare_opcode_cycles(const void* a, const void* b)
+{
+    uint64_t cycles_a = sort_profile->opcode_cycles[*(const uint8_t*)a];
+    uint64_t cycles_b = sort_profile->opcode_cycles[*(const uint8_t*)b];
+    return cycles_a < cycles_b ? 1 : cycles_a > cycles_b ? -1 : 0;
+}
+
+// Write the text report.
+bool cpu_profile_report(const struct cpu_profile* profile, FILE* file)
+{
+    // Total everything up.
+    uint64_t instructions = 0, cycles = profile->interrupt_cycles;
+    for (int i = 0; i < 0x100; ++i)
+    {
+        instructions += profile->opcode_counts[i];
+        cycles += profile->opcode_cycles[i];
+    }
+    double percent = cycles ? 100.0 / cycles : 0.0;
+    fprintf(file, "cpu profile: %llu instruction(s), %llu cycle(s), %llu in interrupt entry\n",
+        (unsigned long long)instructions, (unsigned long long)cycles,
+        (unsigned long long)profile->interrupt_cycles);
+
+    // Print the opcodes that ran, by cycles spent.
+    uint8_t opcodes[0x100];
+    int opcode_count = 0;
+    for (int i = 0; i < 0x100; ++i)
+        if (profile->opcode_counts[i])
+            opcodes[opcode_count++] = i;
+    sort_profile = profile;
+    qsort(opcodes, opcode_count, sizeof(uint8_t), compare_opcode_cycles);
+    fprintf(file, "\n  %-6s %-4s %14s %14s %6s\n", "opcode", "", "count", "cycles", "%");
+    for (int i = 0; i < opcode_count; ++i)
+    {
+        uint8_t opcode = opcodes[i];
+        fprintf(file, "  $%02X    %-4s %14llu %14llu %6.2f\n", opcode, cpu_opcode_name(opcode),
+            (unsigned long long)profile->opcode_counts[opcode],
+            (unsigned long long)profile->opcode_cycles[opcode], profile->opcode_cycles[opcode] * percent);
+    }
+
+    // Print the hottest addresses.
+    uint16_t* pcs = safe_malloc(0x10000 * sizeof(uint16_t));
+    uint32_t pc_count = 0;
+    for (uint32_t pc = 0; pc < 0x10000; ++pc)
+        if (profile->pc_counts[pc])
+            pcs[pc_count++] = pc;
+    qsort(pcs, pc_count, sizeof(uint16_t), compare_pc_cycles);
+    fprintf(file, "\n  %-5s %-4s %-7s %14s %14s %6s\n", "addr", "", "routine", "count", "cycles", "%");
+    for (uint32_t i = 0; i < pc_count && i < REPORT_HOT_ADDRESSES; ++i)
+    {
+        // Addresses below every known entry point are shown without a routine.
+        uint16_t pc = pcs[i];
+        char routine[8] = "-";
+        int32_t entry = routine_of(profile, pc);
+        if (entry >= 0)
+            snprintf(routine, sizeof(routine), "$%04X", (unsigned)entry);
+        fprintf(file, "  $%04X %-4s %-7s %14llu %14llu %6.2f\n", pc, cpu_opcode_name(profile->pc_opcodes[pc]),
+            routine, (unsigned long long)profile->pc_counts[pc],
+            (unsigned long long)profile->pc_cycles[pc], profile->pc_cycles[pc] * percent);
+    }
+    free(pcs);
+    return !ferror(file);
+}
+
+// Write the profile in callgrind format.
+bool cpu_profile_callgrind(const struct cpu_profile* profile, const char* rom_path, FILE* file)
+{
+    // Write the header.
+    uint64_t instructions = 0, cycles = 0;
+    for (int i = 0; i < 0x100; ++i)
+    {
+        instructions += profile->opcode_counts[i];
+        cycles += profile->opcode_cycles[i];
+    }
+    fprintf(file, "# callgrind format\nversion: 1\ncreator: nesemu\npositions: instr\n");
+    fprintf(file, "events: Cycles Instructions\nsummary: %llu %llu\n\n",
+        (unsigned long long)cycles, (unsigned long long)instructions);
+    fprintf(file, "ob=%s\nfl=%s\n", rom_path, rom_path);
+
+    // Write every address that ran, starting a new function whenever the routine
+    // changes. Addresses below the first entry point are grouped on their own.
+    int32_t routine = -1, written = -2;
+    for (uint32_t pc = 0; pc < 0x10000; ++pc)
+    {
+        if (is_entry(profile, pc))
+            routine = pc;
+        if (!profile->pc_counts[pc])
+            continue;
+        if (routine != written)
+        {
+            if (routine < 0)
+                fprintf(file, "fn=unknown\n");
+            else
+                fprintf(file, "fn=sub_%04X\n", routine);
+            written = routine;
+        }
+        fprintf(file, "0x%04X %llu %llu\n", pc, (unsigned long long)profile->pc_cycles[pc],
+            (unsigned long long)profile->pc_counts[pc]);
+    }
+    return !ferror(file);
+}
+
+// Create a new, empty CPU profile.
+struct cpu_profile* cpu_profile_alloc()
+{
+    return safe_calloc(1, sizeof(struct cpu_profile));
+}
+
+// Free a CPU profile.
+void cpu_profile_free(struct cpu_profile* profile)
+{
+    free(profile);
+}
\ No newline at end of file
@@ -0,0 +1,79 @@
+/*
+; Game code profiler. Counts how often each opcode executes and how many CPU cycles
+; are spent at each address, and writes them out as a text report and as a callgrind
+; profile, for finding the hot loops of the game being run.
+;
+; Like the subsystem profiler, this is compiled out unless NES_PROFILE is defined. When
+; compiled in, it still costs nothing until a profile is attached to a CPU.
+*/
+
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// CPU profile struct definition. The counters are flat arrays indexed by opcode and
+// by address, so that counting an instruction is a handful of increments.
+struct cpu_profile
+{
+    uint64_t opcode_counts[0x100];      // Executions of each opcode.
+    uint64_t opcode_cycles[0x100];      // Cycles spent executing each opcode.
+    uint64_t pc_counts[0x10000];        // Instructions executed at each address.
+    uint64_t pc_cycles[0x10000];        // Cycles spent at each address.
+    uint8_t pc_opcodes[0x10000];        // Opcode last executed at each address.
+    uint8_t entry_points[0x10000 / 8];  // Bitmap of subroutine and interrupt handler addresses.
+    uint64_t interrupt_cycles;          // Cycles spent entering interrupt handlers.
+    bool started;
+};
+
+// Mark an address as the start of a routine.
+inline void cpu_profile_entry(struct cpu_profile* profile, uint16_t pc)
+{
+    profile->entry_points[pc >> 3] |= 1 << (pc & 7);
+}
+
+// Count an instruction executed at the given address, taking the given number of
+// cycles. Subroutine calls mark where they land as a routine.
+inline void cpu_profile_instruction(struct cpu_profile* profile, uint16_t pc, uint8_t opcode,
+    uint8_t cycles, uint16_t next_pc)
+{
+    // Whatever runs first is a routine of its own, even if it wasn't called.
+    if (!profile->started)
+    {
+        cpu_profile_entry(profile, pc);
+        profile->started = true;
+    }
+
+    profile->opcode_counts[opcode]++;
+    profile->opcode_cycles[opcode] += cycles;
+    profile->pc_counts[pc]++;
+    profile->pc_cycles[pc] += cycles;
+    profile->pc_opcodes[pc] = opcode;
+
+    // JSR.
+    if (opcode == 0x20)
+        cpu_profile_entry(profile, next_pc);
+}
+
+// Count an interrupt landing in the handler at the given address.
+inline void cpu_profile_interrupt(struct cpu_profile* profile, uint16_t handler, uint8_t cycles)
+{
+    cpu_profile_entry(profile, handler);
+    profile->interrupt_cycles += cycles;
+}
+
+// Write the text report: the opcode histogram and the hottest addresses. Returns false
+// on failure.
+bool cpu_profile_report(const struct cpu_profile* profile, FILE* file);
+
+// Write the profile in callgrind format, with each address as an instruction position
+// and the addresses grouped into routines by the subroutine calls and interrupts seen.
+// Returns false on failure.
+bool cpu_profile_callgrind(const struct cpu_profile* profile, const char* rom_path, FILE* file);
+
+// Create a new, empty CPU profile.
+struct cpu_profile* cpu_profile_alloc();
+
+// Free a CPU profile.
+void cpu_profile_free(struct cpu_profile* profile);
\ No newline at end of file
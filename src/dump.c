@@ -0,0 +1,395 @@
+/*
+; Audio/video dumping.
+;
+; The emulation thread converts each frame to YUV 4:2:0 straight into a preallocated
+; queue entry (which also makes the entry 2.7x smaller than the RGBA frame), and
+; the writer thread takes the entries off the queue in order and writes them out.
+; The queue is a single-producer, single-consumer ring of DUMP_QUEUE_ENTRIES entries
+; guarded by two semaphores counting its free and filled entries.
+;
+; The video is written as YUV4MPEG2 (BT.601, limited range, chroma sited at the
+; centre of each 2x2 block), and the audio as 16-bit mono PCM WAV. The WAV header
+; is written with unknown sizes first, then patched up when the dump is freed if
+; the file is seekable, so that either can be piped straight into an encoder.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <memory.h>
+#include <stdint.h>
+#include <stdbool.h>
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
+
+#include "SDL.h"
+
+#include "constants.h"
+#include "util.h"
+#include "nes.h"
+#include "dump.h"
+
+// SSE2 is always available on x86-64.
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DUMP_SSE2
+#include <emmintrin.h>
+#endif
+
+// YUV 4:2:0 frame layout: a full-size Y plane followed by quarter-size U and V planes.
+#define DUMP_Y_SIZE             (NES_W * NES_H)
+#define DUMP_FRAME_SIZE         (DUMP_Y_SIZE * 3 / 2)
+
+// Each queue entry is big enough for a frame, or for this many audio samples.
+#define DUMP_ENTRY_SAMPLES      (DUMP_FRAME_SIZE / sizeof(int16_t))
+
+// Internal error message buffer.
+static char error_msg[128];
+
+// Queue entry types.
+enum dump_entry_type
+{
+    DUMP_VIDEO,                 // A YUV 4:2:0 frame.
+    DUMP_AUDIO,                 // Audio samples.
+    DUMP_STOP                   // Tells the writer thread to exit.
+};
+
+// Queue entry.
+struct dump_entry
+{
+    enum dump_entry_type type;
+    uint32_t size;              // Size of the data, in bytes.
+    uint8_t* data;              // DUMP_FRAME_SIZE bytes
+};
+
+// Dump struct definition.
+struct dump
+{
+    // Output files.
+    FILE* video;
+    FILE* audio;
+    uint32_t sample_rate;
+    uint64_t audio_size;        // Number of bytes of samples written so far.
+    volatile uint32_t failed;   // Set by the writer thread if a write fails.
+
+    // Writer queue. The emulation thread fills entries at head; the writer thread
+    // drains them from tail.
+    struct dump_entry entries[DUMP_QUEUE_ENTRIES];
+    uint32_t head;
+    uint32_t tail;
+    SDL_sem* free_entries;
+    SDL_sem* filled_entries;
+    SDL_Thread* thread;
+};
+
+// WAV file header.
+#pragma pack(push, 1)
+struct wav_header
+{
+    char riff[4];               // "RIFF"
+    uint32_t riff_size;         // size of the rest of the file
+    char wave[4];               // "WAVE"
+    char fmt[4];                // "fmt "
+    uint32_t fmt_size;          // 16
+    uint16_t format;            // 1 (PCM)
+    uint16_t channels;
+    uint32_t sample_rate;
+    uint32_t byte_rate;
+    uint16_t block_align;
+    uint16_t bits_per_sample;
+    char data[4];               // "data"
+    uint32_t data_size;         // size of the samples
+};
+#pragma pack(pop)
+
+// Write a WAV header for the given amount of sample data.
+static bool write_wav_header(FILE* file, uint32_t sample_rate, uint64_t data_size)
+{
+    // Sizes that don't fit (or aren't known yet) are left at their maximum, which
+    // most readers take to mean "until the end of the stream".
+    uint32_t size = (uint32_t)min(data_size, (uint64_t)UINT32_MAX - sizeof(struct wav_header));
+    struct wav_header header =
+    {
+        .riff = {'R', 'I', 'F', 'F'},
+        .riff_size = size + sizeof(struct wav_header) - 8,
+        .wave = {'W', 'A', 'V', 'E'},
+        .fmt = {'f', 'm', 't', ' '},
+        .fmt_size = 16,
+        .format = 1,
+        .channels = 1,
+        .sample_rate = sample_rate,
+        .byte_rate = sample_rate * sizeof(int16_t),
+        .block_align = sizeof(int16_t),
+        .bits_per_sample = 16,
+        .data = {'d', 'a', 't', 'a'},
+        .data_size = size
+    };
+    return fwrite(&header, sizeof(header), 1, file) == 1;
+}
+
+// Convert a block of 2x2 pixels' RGB averages to chroma.
+#define CHROMA_U(r, g, b)       (((-38 * (r) - 74 * (g) + 112 * (b) + 128) >> 8) + 128)
+#define CHROMA_V(r, g, b)       (((112 * (r) - 94 * (g) - 18 * (b) + 128) >> 8) + 128)
+#define LUMA(r, g, b)           (((66 * (r) + 129 * (g) + 25 * (b) + 128) >> 8) + 16)
+
+#ifdef DUMP_SSE2
+// Split 8 pixels into their R, G and B channels, as 16-bit lanes.
+static inline void split_channels(const struct agbr8888* pixels, __m128i* r, __m128i* g, __m128i* b)
+{
+    const __m128i mask = _mm_set1_epi32(0xFF);
+    __m128i lo = _mm_loadu_si128((const __m128i*)pixels);
+    __m128i hi = _mm_loadu_si128((const __m128i*)(pixels + 4));
+    *r = _mm_packs_epi32(_mm_and_si128(lo, mask), _mm_and_si128(hi, mask));
+    *g = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(lo, 8), mask), _mm_and_si128(_mm_srli_epi32(hi, 8), mask));
+    *b = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(lo, 16), mask), _mm_and_si128(_mm_srli_epi32(hi, 16), mask));
+}
+
+// Convert 8 pixels' channels to luma, and store it. The weighted sum can exceed
+// INT16_MAX but never UINT16_MAX, so it's shifted down as unsigned.
+static inline void store_luma(uint8_t* y, __m128i r, __m128i g, __m128i b)
+{
+    __m128i sum = _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(66)), _mm_mullo_epi16(g, _mm_set1_epi16(129)));
+    sum = _mm_add_epi16(sum, _mm_add_epi16(_mm_mullo_epi16(b, _mm_set1_epi16(25)), _mm_set1_epi16(128)));
+    sum = _mm_add_epi16(_mm_srli_epi16(sum, 8), _mm_set1_epi16(16));
+    _mm_storel_epi64((__m128i*)y, _mm_packus_epi16(sum, sum));
+}
+
+// Average the channels of two rows of 8 pixels into 4 2x2 blocks.
+static inline __m128i average_blocks(__m128i row0, __m128i row1)
+{
+    __m128i sum = _mm_madd_epi16(_mm_add_epi16(row0, row1), _mm_set1_epi16(1));
+    sum = _mm_srai_epi32(_mm_add_epi32(sum, _mm_set1_epi32(2)), 2);
+    return _mm_packs_epi32(sum, sum);
+}
+
+// Convert 4 blocks' averaged channels to a chroma component, and store it.
+static inline void store_chroma(uint8_t* c, __m128i r, __m128i g, __m128i b, int16_t kr, int16_t kg, int16_t kb)
+{
+    __m128i sum = _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(kr)), _mm_mullo_epi16(g, _mm_set1_epi16(kg)));
+    sum = _mm_add_epi16(sum, _mm_add_epi16(_mm_mullo_epi16(b, _mm_set1_epi16(kb)), _mm_set1_epi16(128)));
+    sum = _mm_add_epi16(_mm_srai_epi16(sum, 8), _mm_set1_epi16(128));
+    int32_t packed = _mm_cvtsi128_si32(_mm_packus_epi16(sum, sum));
+    memcpy(c, &packed, sizeof(packed));
+}
+#endif
+
+// Convert a frame to YUV 4:2:0, two rows at a time. Each chroma sample is taken from
+// the average of its 2x2 block.
+static void convert_frame(const struct agbr8888* pixels, size_t pitch, uint8_t* frame)
+{
+    uint8_t* y_plane = frame;
+    uint8_t* u_plane = frame + DUMP_Y_SIZE;
+    uint8_t* v_plane = u_plane + DUMP_Y_SIZE / 4;
+    for (int row = 0; row < NES_H; row += 2)
+    {
+        const struct agbr8888* row0 = (const struct agbr8888*)((const uint8_t*)pixels + row * pitch);
+        const struct agbr8888* row1 = (const struct agbr8888*)((const uint8_t*)row0 + pitch);
+        uint8_t* y0 = y_plane + row * NES_W;
+        uint8_t* y1 = y0 + NES_W;
+        uint8_t* u = u_plane + row / 2 * (NES_W / 2);
+        uint8_t* v = v_plane + row / 2 * (NES_W / 2);
+        int x = 0;
+#ifdef DUMP_SSE2
+        // 8 pixels of each row at a time.
+        for (; x < NES_W; x += 8)
+        {
+            __m128i r0, g0, b0, r1, g1, b1;
+            split_channels(row0 + x, &r0, &g0, &b0);
+            split_channels(row1 + x, &r1, &g1, &b1);
+            store_luma(y0 + x, r0, g0, b0);
+            store_luma(y1 + x, r1, g1, b1);
+            __m128i r = average_blocks(r0, r1), g = average_blocks(g0, g1), b = average_blocks(b0, b1);
+            store_chroma(u + x / 2, r, g, b, -38, -74, 112);
+            store_chroma(v + x / 2, r, g, b, 112, -94, -18);
+        }
+#endif
+        // Whatever is left, one 2x2 block at a time.
+        for (; x < NES_W; x += 2)
+        {
+            const struct agbr8888* p[4] = {&row0[x], &row0[x + 1], &row1[x], &row1[x + 1]};
+            y0[x] = LUMA(p[0]->r, p[0]->g, p[0]->b);
+            y0[x + 1] = LUMA(p[1]->r, p[1]->g, p[1]->b);
+            y1[x] = LUMA(p[2]->r, p[2]->g, p[2]->b);
+            y1[x + 1] = LUMA(p[3]->r, p[3]->g, p[3]->b);
+            int r = (p[0]->r + p[1]->r + p[2]->r + p[3]->r + 2) >> 2;
+            int g = (p[0]->g + p[1]->g + p[2]->g + p[3]->g + 2) >> 2;
+            int b = (p[0]->b + p[1]->b + p[2]->b + p[3]->b + 2) >> 2;
+            u[x / 2] = CHROMA_U(r, g, b);
+            v[x / 2] = CHROMA_V(r, g, b);
+        }
+    }
+}
+
+// Take the next free queue entry, waiting for the writer thread if there are none.
+static struct dump_entry* acquire_entry(struct dump* dump)
+{
+    SDL_SemWait(dump->free_entries);
+    return &dump->entries[dump->head++ % DUMP_QUEUE_ENTRIES];
+}
+
+// Hand a filled-in queue entry to the writer thread.
+static void submit_entry(struct dump* dump)
+{
+    SDL_SemPost(dump->filled_entries);
+}
+
+// Writer thread. Writes out the queue entries in order until told to stop.
+static int writer(void* userdata)
+{
+    struct dump* dump = userdata;
+    for (;;)
+    {
+        SDL_SemWait(dump->filled_entries);
+        struct dump_entry* entry = &dump->entries[dump->tail++ % DUMP_QUEUE_ENTRIES];
+        bool success = true;
+        switch (entry->type)
+        {
+        case DUMP_VIDEO:
+            success = fputs("FRAME\n", dump->video) >= 0
+                && fwrite(entry->data, entry->size, 1, dump->video) == 1;
+            break;
+        case DUMP_AUDIO:
+            success = fwrite(entry->data, entry->size, 1, dump->audio) == 1;
+            dump->audio_size += entry->size;
+            break;
+        case DUMP_STOP:
+            return 0;
+        }
+        if (!success)
+            atomic_store_u32(&dump->failed, true);
+        SDL_SemPost(dump->free_entries);
+    }
+}
+
+// Queue a frame for writing.
+void dump_video(struct dump* dump, const struct agbr8888* pixels, size_t pitch)
+{
+    if (dump->video == NULL)
+        return;
+    struct dump_entry* entry = acquire_entry(dump);
+    entry->type = DUMP_VIDEO;
+    entry->size = DUMP_FRAME_SIZE;
+    convert_frame(pixels, pitch, entry->data);
+    submit_entry(dump);
+}
+
+// Queue audio samples for writing.
+void dump_audio(struct dump* dump, const int16_t* samples, uint32_t count)
+{
+    if (dump->audio == NULL)
+        return;
+    while (count)
+    {
+        uint32_t chunk = min(count, (uint32_t)DUMP_ENTRY_SAMPLES);
+        struct dump_entry* entry = acquire_entry(dump);
+        entry->type = DUMP_AUDIO;
+        entry->size = chunk * sizeof(int16_t);
+        memcpy(entry->data, samples, entry->size);
+        submit_entry(dump);
+        samples += chunk;
+        count -= chunk;
+    }
+}
+
+// Open a dump output file; "-" is stdout.
+static FILE* open_output(const char* path)
+{
+    if (strcmp(path, "-"))
+        return fopen(path, "wb");
+#ifdef _WIN32
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+    return stdout;
+}
+
+// Create a new dump instance.
+struct dump* dump_alloc(const char* video_path, const char* audio_path, uint32_t sample_rate)
+{
+    // Allocate a new dump instance.
+    struct dump* dump = safe_calloc(1, sizeof(struct dump));
+    dump->sample_rate = sample_rate;
+    for (int i = 0; i < DUMP_QUEUE_ENTRIES; ++i)
+        dump->entries[i].data = safe_malloc(DUMP_FRAME_SIZE);
+
+    // Open the output files and write their headers. The frame rate is that of the
+    // NTSC PPU: 341 x 262 dots per frame, less half a dot for the skipped dot on odd
+    // frames, and the pixel aspect ratio is 8:7.
+    if (video_path && (dump->video = open_output(video_path)) == NULL)
+    {
+        snprintf(error_msg, sizeof(error_msg), "could not open %s", video_path);
+        goto failed;
+    }
+    if (audio_path && (dump->audio = open_output(audio_path)) == NULL)
+    {
+        snprintf(error_msg, sizeof(error_msg), "could not open %s", audio_path);
+        goto failed;
+    }
+    if (dump->video)
+        fprintf(dump->video, "YUV4MPEG2 W%d H%d F%u:%u Ip A8:7 C420jpeg XCOLORRANGE=LIMITED\n",
+            NES_W, NES_H, MASTER_CLOCK / 4 * 2, 341 * 262 * 2 - 1);
+    if (dump->audio)
+        write_wav_header(dump->audio, sample_rate, UINT32_MAX);
+
+    // Start the writer thread.
+    dump->free_entries = SDL_CreateSemaphore(DUMP_QUEUE_ENTRIES);
+    dump->filled_entries = SDL_CreateSemaphore(0);
+    if (dump->free_entries == NULL || dump->filled_entries == NULL
+        || (dump->thread = SDL_CreateThread(writer, "dump", dump)) == NULL)
+    {
+        snprintf(error_msg, sizeof(error_msg), "could not start the writer thread: %s", SDL_GetError());
+        goto failed;
+    }
+
+    // Return the dump.
+    return dump;
+
+    // Clean up after a failure.
+failed:
+    dump_free(dump);
+    return NULL;
+}
+
+// Flush and free a dump instance.
+bool dump_free(struct dump* dump)
+{
+    if (dump == NULL)
+        return true;
+
+    // Stop the writer thread once it has drained the queue.
+    if (dump->thread)
+    {
+        struct dump_entry* entry = acquire_entry(dump);
+        entry->type = DUMP_STOP;
+        submit_entry(dump);
+        SDL_WaitThread(dump->thread, NULL);
+    }
+    bool success = !dump->failed;
+
+    // Patch up the WAV header now that its sizes are known, if the file is seekable.
+    if (dump->audio && dump->audio != stdout && fseek(dump->audio, 0, SEEK_SET) == 0)
+        success &= write_wav_header(dump->audio, dump->sample_rate, dump->audio_size);
+
+    // Close the output files.
+    if (dump->video && dump->video != stdout)
+        success &= fclose(dump->video) == 0;
+    if (dump->audio && dump->audio != stdout)
+        success &= fclose(dump->audio) == 0;
+    if (dump->video == stdout || dump->audio == stdout)
+        success &= fflush(stdout) == 0;
+    if (!success)
+        snprintf(error_msg, sizeof(error_msg), "could not write all of the output");
+
+    // Free the dump.
+    SDL_DestroySemaphore(dump->free_entries);
+    SDL_DestroySemaphore(dump->filled_entries);
+    for (int i = 0; i < DUMP_QUEUE_ENTRIES; ++i)
+        free(dump->entries[i].data);
+    free(dump);
+    return success;
+}
+
+// Get the dump error message.
+const char* dump_error_msg()
+{
+    return error_msg;
+}
\ No newline at end of file
@@ -0,0 +1,36 @@
+/*
+; Audio/video dumping: streams every frame out as YUV4MPEG2 video and the audio as
+; WAV, through a writer thread so that the emulation never waits on the disk.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "ppu.h"
+
+// Number of buffers queued up for the writer thread. Once they are all in use, the
+// emulation waits for the writer to catch up rather than dropping any output.
+#define DUMP_QUEUE_ENTRIES      16
+
+// Dump struct definition. The fields are internal; see dump.c.
+struct dump;
+
+// Queue a frame for writing. The pixels hold NES_H rows of NES_W pixels, each row
+// being pitch bytes apart, and are converted to YUV 4:2:0 before this returns.
+void dump_video(struct dump* dump, const struct agbr8888* pixels, size_t pitch);
+
+// Queue mono 16-bit audio samples for writing.
+void dump_audio(struct dump* dump, const int16_t* samples, uint32_t count);
+
+// Create a new dump, writing the video and/or audio to the given files ("-" for
+// stdout; NULL to leave it out). Returns NULL on failure; see dump_error_msg().
+struct dump* dump_alloc(const char* video_path, const char* audio_path, uint32_t sample_rate);
+
+// Flush and free a dump instance. Returns false if anything failed to be written;
+// see dump_error_msg().
+bool dump_free(struct dump* dump);
+
+// Get the dump error message.
+const char* dump_error_msg();
\ No newline at end of file
@@ -0,0 +1,148 @@
+/*
+; Branch exploration.
+;
+; Every branch starts from a clone of the base computer: since the machine state is
+; one block of plain data, cloning it is a single memcpy(), which costs far less
+; than emulating even one frame. Each worker thread keeps one computer of its own
+; and keeps claiming the next branch until there are none left, so that branches
+; ending early don't leave a thread idle.
+;
+; The clones all share the base computer's cartridge (see struct cartridge).
+*/
+
+#include <stdio.h>
+#include <memory.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "SDL.h"
+
+#include "util.h"
+#include "explore.h"
+
+// Internal error message buffer.
+static char error_msg[128];
+
+// Shared exploration state.
+struct explore
+{
+    struct nes* base;
+    struct explore_branch* branches;
+    uint32_t branch_count;
+    struct state_set* visited;
+    explore_scorer scorer;
+    void* userdata;
+    uint32_t max_frame_count;       // Length of the longest branch.
+    volatile uint32_t next_branch;  // The next branch to hand out to a worker.
+};
+
+// Run a branch on a computer. suffixes has room for a hash per frame of the branch.
+static void run_branch(struct explore* explore, struct nes* computer, struct explore_branch* branch,
+    uint64_t* suffixes)
+{
+    // Start over from the base state. Only branches that want the pixels get them.
+    nes_clone(computer, explore->base);
+    nes_setscreen(computer, branch->screen, NES_W * sizeof(struct agbr8888));
+    computer->render_skip = branch->screen == NULL;
+
+    // Hash the input still to come from each frame on, working back from the end so
+    // that each frame's input is only hashed once.
+    if (explore->visited)
+    {
+        uint64_t suffix = 0;
+        for (uint32_t frame = branch->frame_count; frame-- > 0;)
+            suffixes[frame] = suffix = hash64(suffix, branch->inputs + (size_t)frame * 2, 2);
+    }
+
+    // Run the input, scoring each frame, until it runs out, the scorer calls it off, or
+    // it reaches a state that has been visited before with the same input still to
+    // come. The state alone isn't enough: branches with different input from there on
+    // have different futures, even though they may all pass through the same states
+    // while the game ignores the input. A branch that has run all its input has nothing
+    // left to cut short, so its last state isn't looked up.
+    branch->score = 0;
+    branch->pruned = false;
+    uint32_t frame = 0;
+    while (frame < branch->frame_count)
+    {
+        nes_run_frames(computer, branch->inputs + (size_t)frame * 2, 1, 0);
+        frame++;
+        if (explore->scorer && !explore->scorer(explore->userdata, computer, frame, &branch->score))
+            break;
+        if (explore->visited && frame < branch->frame_count)
+        {
+            uint64_t state = nes_hash(computer);
+            if (!state_set_insert(explore->visited, hash64(suffixes[frame], &state, sizeof(state))))
+            {
+                branch->pruned = true;
+                break;
+            }
+        }
+    }
+
+    // Keep the results.
+    branch->frames_run = frame;
+    memcpy(branch->ram, computer->ram, sizeof(branch->ram));
+}
+
+// Worker thread. Keeps claiming the next branch until every branch has been handed out.
+static int worker(void* userdata)
+{
+    struct explore* explore = userdata;
+    struct nes* computer = nes_alloc();
+    uint64_t* suffixes = explore->visited ? safe_malloc(explore->max_frame_count * sizeof(uint64_t)) : NULL;
+    for (;;)
+    {
+        uint32_t index = atomic_add_u32(&explore->next_branch, 1);
+        if (index >= explore->branch_count)
+            break;
+        run_branch(explore, computer, &explore->branches[index], suffixes);
+    }
+    free(suffixes);
+    nes_free(computer);
+    return 0;
+}
+
+// Run a batch of branches from a base state.
+bool explore_run(struct nes* base, struct explore_branch* branches, uint32_t branch_count,
+    unsigned threads, struct state_set* visited, explore_scorer scorer, void* userdata)
+{
+    // Set up the exploration.
+    struct explore explore;
+    memset(&explore, 0, sizeof(explore));
+    explore.base = base;
+    explore.branches = branches;
+    explore.branch_count = branch_count;
+    explore.visited = visited;
+    explore.scorer = scorer;
+    explore.userdata = userdata;
+    for (uint32_t i = 0; i < branch_count; ++i)
+        explore.max_frame_count = max(explore.max_frame_count, branches[i].frame_count);
+    if (threads == 0)
+        threads = max(SDL_GetCPUCount(), 1);
+    threads = min(threads, max(branch_count, 1));
+
+    // Start the workers. Carry on with however many could be started.
+    SDL_Thread** workers = safe_calloc(threads, sizeof(SDL_Thread*));
+    unsigned started = 0;
+    for (unsigned i = 0; i < threads; ++i)
+    {
+        if ((workers[started] = SDL_CreateThread(worker, "explore", &explore)) != NULL)
+            started++;
+    }
+    bool success = started > 0 || branch_count == 0;
+    if (!success)
+        snprintf(error_msg, sizeof(error_msg), "could not start the worker threads: %s", SDL_GetError());
+
+    // Wait for every branch to be run.
+    for (unsigned i = 0; i < started; ++i)
+        SDL_WaitThread(workers[i], NULL);
+    free(workers);
+    return success;
+}
+
+// Get the explore error message.
+const char* explore_error_msg()
+{
+    return error_msg;
+}
\ No newline at end of file
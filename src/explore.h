@@ -0,0 +1,46 @@
+/*
+; Branch exploration: runs a batch of input sequences from the same starting state,
+; each on its own clone of the machine, side by side on worker threads. Meant for
+; bots and TAS tools searching for the best input to give a game.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "nes.h"
+#include "state_set.h"
+
+// A branch: an input sequence to run from the base state, and what came of it.
+struct explore_branch
+{
+    // Input: two bytes (controller ports 0 and 1) per frame, laid out as in movies.
+    const uint8_t* inputs;
+    uint32_t frame_count;
+    struct agbr8888* screen;    // If set, receives each frame run (NES_H rows of NES_W pixels).
+
+    // Results.
+    uint32_t frames_run;        // Number of frames run before the branch ended.
+    bool pruned;                // Set if the branch ended by repeating a visited state.
+    int64_t score;              // Last score given by the scorer (0 if there is none).
+    uint8_t ram[0x800];         // Internal RAM at the end of the branch.
+};
+
+// Scores a branch after each of its frames; frame is the number of frames run so far.
+// Returns false to end the branch there. It is called from the worker threads, and
+// so must be safe to call from several threads at once.
+typedef bool (*explore_scorer)(void* userdata, struct nes* computer, uint32_t frame, int64_t* score);
+
+// Run every branch from the state of the base computer, which is left untouched.
+// threads is the number of worker threads to use (0: one per CPU). If visited is set,
+// the state after each frame, together with the input left to run, is added to it,
+// and a branch ends as soon as it reaches a pair already there, whether from this
+// batch or an earlier one: from there on, it would only repeat a run already made.
+// scorer may be NULL, in which case every branch runs to the end of its input.
+// Returns false on failure; see explore_error_msg().
+bool explore_run(struct nes* base, struct explore_branch* branches, uint32_t branch_count,
+    unsigned threads, struct state_set* visited, explore_scorer scorer, void* userdata);
+
+// Get the explore error message.
+const char* explore_error_msg();
\ No newline at end of file
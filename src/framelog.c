@@ -0,0 +1,291 @@
+/*
+; Frame logs.
+;
+; The file starts with a header, followed by one record per frame, followed by the
+; index: the file offset of every record, as an 8-byte aligned array of 64-bit
+; values, so that a reader can map the file and jump straight to any record.
+;
+; Each record holds the frame number and input, then the RAM and the pixels coded
+; as runs against a reference: the previous frame, or an all-zero frame for intra
+; frames (every FRAMELOG_INTRA_INTERVAL frames); see run_encode(). Little changes
+; from one frame to the next, so most frames code to a few hundred bytes.
+*/
+
+#include <stdio.h>
+#include <memory.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "util.h"
+#include "framelog.h"
+
+#define FRAMELOG_MAGIC      0x1A4C464E  // "NFL\x1A"
+#define FRAMELOG_VERSION    1
+
+// Size of the coded part of a frame, uncoded, and the worst case of it coded.
+#define FRAME_DATA_SIZE     (0x800 + NES_W * NES_H)
+#define CODED_MAX_SIZE      RUN_CODED_MAX_SIZE(FRAME_DATA_SIZE)
+
+// Internal error message buffer.
+static char error_msg[128];
+
+// The reference of intra frames.
+static const uint8_t blank[NES_W * NES_H];
+
+// Frame log file format header.
+struct framelog_header
+{
+    int32_t magic;              // "NFL\x1A"; see FRAMELOG_MAGIC macro
+    uint16_t version;           // see FRAMELOG_VERSION macro
+    uint16_t intra_interval;    // a frame is coded whole every this many frames
+    uint16_t width;             // NES_W
+    uint16_t height;            // NES_H
+    uint32_t rom_crc32;         // CRC-32 of the iNES file
+    uint32_t frame_count;       // number of records
+    uint32_t reserved;
+    uint64_t index_offset;      // file offset of the index
+};
+
+// Frame record header.
+struct framelog_record
+{
+    uint32_t frame;             // frame number
+    uint8_t input[2];           // controller ports 0 and 1
+    uint8_t intra;              // coded against a blank frame rather than the previous one
+    uint8_t reserved;
+    uint32_t size;              // size of the coded RAM and pixels that follow
+};
+
+// Log a frame.
+bool framelog_write(struct framelog_writer* writer, uint32_t frame, const union controller controllers[2],
+    const uint8_t ram[0x800])
+{
+    // Grow the index if necessary.
+    if (writer->frame_count == writer->frame_capacity)
+    {
+        writer->frame_capacity = writer->frame_capacity ? writer->frame_capacity * 2 : 1024;
+        uint64_t* offsets = safe_calloc(writer->frame_capacity, sizeof(uint64_t));
+        memcpy(offsets, writer->offsets, writer->frame_count * sizeof(uint64_t));
+        free(writer->offsets);
+        writer->offsets = offsets;
+    }
+
+    // Fill in the rest of the frame.
+    struct framelog_frame* current = &writer->current;
+    struct framelog_frame* previous = &writer->previous;
+    current->frame = frame;
+    current->input[0] = controllers[0].value;
+    current->input[1] = controllers[1].value;
+    memcpy(current->ram, ram, sizeof(current->ram));
+
+    // Code the RAM and pixels.
+    struct framelog_record record;
+    memset(&record, 0, sizeof(record));
+    record.frame = frame;
+    record.input[0] = current->input[0];
+    record.input[1] = current->input[1];
+    record.intra = writer->frame_count % FRAMELOG_INTRA_INTERVAL == 0;
+    size_t size = run_encode(current->ram, record.intra ? blank : previous->ram, sizeof(current->ram),
+        writer->buffer);
+    size += run_encode(current->pixels, record.intra ? blank : previous->pixels, sizeof(current->pixels),
+        writer->buffer + size);
+    record.size = (uint32_t)size;
+
+    // Write the record.
+    if (fwrite(&record, sizeof(record), 1, writer->file) != 1
+        || fwrite(writer->buffer, size, 1, writer->file) != 1)
+    {
+        snprintf(error_msg, sizeof(error_msg), "write failed");
+        return false;
+    }
+    writer->offsets[writer->frame_count++] = writer->offset;
+    writer->offset += sizeof(record) + size;
+
+    // The next frame is coded against this one.
+    memcpy(previous, current, sizeof(struct framelog_frame));
+    return true;
+}
+
+// Create a new frame log writer.
+struct framelog_writer* framelog_writer_alloc(const char* path, uint32_t rom_crc32)
+{
+    // Open the file.
+    FILE* file = fopen(path, "wb");
+    if (file == NULL)
+    {
+        snprintf(error_msg, sizeof(error_msg), "could not open %s", path);
+        return NULL;
+    }
+
+    // Allocate a new frame log writer instance.
+    struct framelog_writer* writer = safe_malloc(sizeof(struct framelog_writer));
+    writer->file = file;
+    writer->rom_crc32 = rom_crc32;
+    writer->buffer = safe_malloc(CODED_MAX_SIZE);
+
+    // Reserve room for the header; it's written once the frame count is known.
+    struct framelog_header header;
+    memset(&header, 0, sizeof(header));
+    if (fwrite(&header, sizeof(header), 1, file) != 1)
+    {
+        snprintf(error_msg, sizeof(error_msg), "write failed");
+        fclose(file);
+        free(writer->buffer);
+        free(writer);
+        return NULL;
+    }
+    writer->offset = sizeof(header);
+
+    // Return the frame log writer.
+    return writer;
+}
+
+// Finish the frame log and free the writer.
+bool framelog_writer_free(struct framelog_writer* writer)
+{
+    if (writer == NULL)
+        return true;
+
+    // Write the index, 8-byte aligned, then go back and write the header.
+    static const uint8_t padding[8];
+    size_t padding_size = (8 - writer->offset % 8) % 8;
+    struct framelog_header header =
+    {
+        .magic = FRAMELOG_MAGIC,
+        .version = FRAMELOG_VERSION,
+        .intra_interval = FRAMELOG_INTRA_INTERVAL,
+        .width = NES_W,
+        .height = NES_H,
+        .rom_crc32 = writer->rom_crc32,
+        .frame_count = writer->frame_count,
+        .index_offset = writer->offset + padding_size
+    };
+    bool success = fwrite(padding, 1, padding_size, writer->file) == padding_size
+        && fwrite(writer->offsets, sizeof(uint64_t), writer->frame_count, writer->file) == writer->frame_count
+        && fseek(writer->file, 0, SEEK_SET) == 0
+        && fwrite(&header, sizeof(header), 1, writer->file) == 1;
+    success &= fclose(writer->file) == 0;
+    if (!success)
+        snprintf(error_msg, sizeof(error_msg), "could not finish the frame log");
+
+    // Free the writer.
+    free(writer->offsets);
+    free(writer->buffer);
+    free(writer);
+    return success;
+}
+
+// Decode a frame record against the given reference.
+static bool decode_frame(struct framelog_reader* reader, uint32_t index, const struct framelog_frame* ref,
+    struct framelog_frame* frame)
+{
+    // Locate the record.
+    const struct framelog_header* header = (const struct framelog_header*)reader->data;
+    uint64_t offset = reader->offsets[index];
+    if (offset < sizeof(*header) || offset > header->index_offset - sizeof(struct framelog_record))
+        return false;
+    struct framelog_record record;
+    memcpy(&record, reader->data + offset, sizeof(record));
+    const uint8_t* in = reader->data + offset + sizeof(record);
+    if (record.size > header->index_offset - offset - sizeof(record))
+        return false;
+
+    // Decode it.
+    frame->frame = record.frame;
+    frame->input[0] = record.input[0];
+    frame->input[1] = record.input[1];
+    size_t used = run_decode(in, record.size, record.intra ? blank : ref->ram, sizeof(frame->ram), frame->ram);
+    return used && run_decode(in + used, record.size - used, record.intra ? blank : ref->pixels,
+        sizeof(frame->pixels), frame->pixels);
+}
+
+// Decode the frame at the given index of the frame log.
+const struct framelog_frame* framelog_read(struct framelog_reader* reader, uint32_t index)
+{
+    if (index >= reader->frame_count)
+        return NULL;
+
+    // Start from the intra frame at or before the frame, unless the frame that has
+    // already been decoded is closer. Every delta frame is decoded in place, as runs
+    // only ever refer back to the same position in the reference.
+    const struct framelog_header* header = (const struct framelog_header*)reader->data;
+    uint32_t first = index - index % header->intra_interval;
+    if (reader->frame_index < reader->frame_count && first <= reader->frame_index && reader->frame_index <= index)
+        first = reader->frame_index + 1;
+    for (uint32_t i = first; i <= index; ++i)
+    {
+        if (!decode_frame(reader, i, &reader->frame, &reader->frame))
+        {
+            reader->frame_index = reader->frame_count;
+            return NULL;
+        }
+        reader->frame_index = i;
+    }
+    return &reader->frame;
+}
+
+// Open a frame log for reading.
+struct framelog_reader* framelog_reader_alloc(const char* path)
+{
+    // Map the file.
+    size_t size;
+    const uint8_t* data = map_file(path, &size);
+    if (data == NULL)
+    {
+        snprintf(error_msg, sizeof(error_msg), "could not map %s", path);
+        return NULL;
+    }
+
+    // Validate the header.
+    const struct framelog_header* header = (const struct framelog_header*)data;
+    if (size < sizeof(*header) || header->magic != FRAMELOG_MAGIC)
+    {
+        snprintf(error_msg, sizeof(error_msg), "not a frame log");
+        goto corrupt;
+    }
+    if (header->version != FRAMELOG_VERSION || header->width != NES_W || header->height != NES_H
+        || header->intra_interval == 0)
+    {
+        snprintf(error_msg, sizeof(error_msg), "unsupported frame log version or format");
+        goto corrupt;
+    }
+    if (header->index_offset % sizeof(uint64_t) || header->index_offset < sizeof(*header) 
+        || header->index_offset > size
+        || (size - header->index_offset) / sizeof(uint64_t) < header->frame_count)
+    {
+        snprintf(error_msg, sizeof(error_msg), "frame log is truncated");
+        goto corrupt;
+    }
+
+    // Allocate a new frame log reader instance.
+    struct framelog_reader* reader = safe_malloc(sizeof(struct framelog_reader));
+    reader->data = data;
+    reader->size = size;
+    reader->rom_crc32 = header->rom_crc32;
+    reader->frame_count = header->frame_count;
+    reader->offsets = (const uint64_t*)(data + header->index_offset);
+    reader->frame_index = reader->frame_count;
+
+    // Return the frame log reader.
+    return reader;
+
+    // Clean up after a corrupt file.
+corrupt:
+    unmap_file(data, size);
+    return NULL;
+}
+
+// Close a frame log and free the reader.
+void framelog_reader_free(struct framelog_reader* reader)
+{
+    if (reader == NULL)
+        return;
+    unmap_file(reader->data, reader->size);
+    free(reader);
+}
+
+// Get the frame log error message.
+const char* framelog_error_msg()
+{
+    return error_msg;
+}
\ No newline at end of file
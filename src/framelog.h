@@ -0,0 +1,91 @@
+/*
+; Frame logs: a compact, memory-mappable record of every frame of a run, holding the
+; palette index of each pixel, the internal RAM and the controller input, for use as
+; training data.
+*/
+
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "constants.h"
+#include "nes.h"
+
+// Every this many frames, a frame is stored whole rather than as a delta against the
+// previous one, bounding how many frames a random access has to decode.
+#define FRAMELOG_INTRA_INTERVAL 60
+
+// A decoded frame.
+struct framelog_frame
+{
+    uint32_t frame;                     // Frame number, counted from power-on.
+    uint8_t input[2];                   // Controller ports 0 and 1.
+    uint8_t ram[0x800];                 // Internal RAM at the end of the frame.
+    uint8_t pixels[NES_W * NES_H];      // 6-bit palette index of each pixel.
+};
+
+// Frame log writer struct definition.
+struct framelog_writer
+{
+    FILE* file;
+    uint32_t rom_crc32;
+
+    // The frame being logged, and the one before it, which the next frame is delta
+    // coded against.
+    struct framelog_frame current;
+    struct framelog_frame previous;
+
+    // Encoding buffer, big enough for the worst case of a frame.
+    uint8_t* buffer;
+
+    // File offset of each frame logged so far, written out as the index at the end.
+    uint64_t* offsets;
+    uint32_t frame_count;
+    uint32_t frame_capacity;
+    uint64_t offset;
+};
+
+// Frame log reader struct definition. The file is mapped into memory, and frames are
+// decoded straight out of the mapping.
+struct framelog_reader
+{
+    const uint8_t* data;
+    size_t size;
+    uint32_t rom_crc32;
+    uint32_t frame_count;
+    const uint64_t* offsets;            // File offset of each frame (points into data).
+
+    // The most recently decoded frame, so that reading frames in order only has to
+    // decode one delta per frame.
+    struct framelog_frame frame;
+    uint32_t frame_index;               // Index of the decoded frame (frame_count: none).
+};
+
+// Log a frame. The pixels must have been written by the PPU into writer->current.pixels
+// (see nes_setindices()) over the frame that has just been emulated. Returns false
+// on failure.
+bool framelog_write(struct framelog_writer* writer, uint32_t frame, const union controller controllers[2],
+    const uint8_t ram[0x800]);
+
+// Create a new frame log writer, writing to the given file. Returns NULL on failure;
+// see framelog_error_msg().
+struct framelog_writer* framelog_writer_alloc(const char* path, uint32_t rom_crc32);
+
+// Finish the frame log and free the writer. Returns false if the frame log could not
+// be finished; see framelog_error_msg().
+bool framelog_writer_free(struct framelog_writer* writer);
+
+// Decode the frame at the given index of the frame log. Returns NULL if the index is
+// out of range or the frame is corrupt. The frame stays valid until the next call.
+const struct framelog_frame* framelog_read(struct framelog_reader* reader, uint32_t index);
+
+// Open a frame log for reading. Returns NULL on failure; see framelog_error_msg().
+struct framelog_reader* framelog_reader_alloc(const char* path);
+
+// Close a frame log and free the reader.
+void framelog_reader_free(struct framelog_reader* reader);
+
+// Get the frame log error message.
+const char* framelog_error_msg();
\ No newline at end of file
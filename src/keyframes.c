@@ -0,0 +1,175 @@
+/*
+; Movie keyframes: save states captured at a fixed frame interval during movie
+; playback, so that any frame of a long movie can be sought to quickly.
+;
+; Seeking restores the nearest earlier keyframe, after which the caller only has
+; to emulate the remaining (at most interval - 1) frames, which can be done with
+; rendering skipped.
+*/
+
+#include <stdio.h>
+#include <memory.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "util.h"
+#include "keyframes.h"
+
+#define KEYFRAMES_MAGIC     0x1A464B4E  // "NKF\x1A"
+
+// Internal error message buffer.
+static char error_msg[128];
+
+// Keyframes sidecar file format header.
+struct keyframes_header
+{
+    int32_t magic;              // "NKF\x1A"; see KEYFRAMES_MAGIC macro
+    uint32_t rom_crc32;         // CRC-32 of the iNES file
+    uint32_t movie_crc32;       // CRC-32 of the movie's seed and input
+    uint32_t interval;          // keyframe interval, in frames
+    uint32_t state_size;        // size of each keyframe; must match nes_state_size()
+    uint32_t count;             // number of keyframes that follow
+};
+
+// Capture the state at the start of the given frame.
+void keyframes_capture(struct keyframes* keyframes, struct nes* computer, uint32_t frame)
+{
+    if (frame % keyframes->interval || frame / keyframes->interval != keyframes->count)
+        return;
+
+    // Grow the snapshot ID buffer if necessary.
+    if (keyframes->count == keyframes->capacity)
+    {
+        keyframes->capacity = keyframes->capacity ? keyframes->capacity * 2 : 64;
+        uint32_t* snapshots = safe_calloc(keyframes->capacity, sizeof(uint32_t));
+        memcpy(snapshots, keyframes->snapshots, keyframes->count * sizeof(uint32_t));
+        free(keyframes->snapshots);
+        keyframes->snapshots = snapshots;
+    }
+
+    // Store the state.
+    keyframes->snapshots[keyframes->count++] = snapshot_save(keyframes->store, computer);
+}
+
+// Restore the latest keyframe at or before the given frame.
+uint32_t keyframes_seek(struct keyframes* keyframes, struct nes* computer, uint32_t frame)
+{
+    assert(keyframes->count);
+    uint32_t index = min(frame / keyframes->interval, keyframes->count - 1);
+    snapshot_restore(keyframes->store, keyframes->snapshots[index], computer);
+    return index * keyframes->interval;
+}
+
+// Save the keyframes to a sidecar file.
+bool keyframes_save(struct keyframes* keyframes, const char* path)
+{
+    FILE* file = fopen(path, "wb");
+    if (file == NULL)
+        return false;
+    struct keyframes_header header =
+    {
+        .magic = KEYFRAMES_MAGIC,
+        .rom_crc32 = keyframes->rom_crc32,
+        .movie_crc32 = keyframes->movie_crc32,
+        .interval = keyframes->interval,
+        .state_size = (uint32_t)keyframes->state_size,
+        .count = keyframes->count
+    };
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1;
+
+    // Write each state out whole.
+    uint8_t* state = safe_malloc(keyframes->state_size);
+    for (uint32_t i = 0; i < keyframes->count && written; ++i)
+    {
+        snapshot_get(keyframes->store, keyframes->snapshots[i], state);
+        written = fwrite(state, keyframes->state_size, 1, file) == 1;
+    }
+    free(state);
+    return (fclose(file) == 0) && written;
+}
+
+// Load keyframes from a sidecar file.
+struct keyframes* keyframes_load(const char* path)
+{
+    // Read the header.
+    FILE* file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        snprintf(error_msg, sizeof(error_msg), "could not open %s", path);
+        return NULL;
+    }
+    struct keyframes_header header;
+    if (fread(&header, sizeof(header), 1, file) != 1)
+    {
+        snprintf(error_msg, sizeof(error_msg), "keyframes header size too small");
+        goto corrupt;
+    }
+
+    // Validate the header. Keyframes are raw save states, so they are only usable by
+    // a build with the same state layout.
+    if (header.magic != KEYFRAMES_MAGIC)
+    {
+        snprintf(error_msg, sizeof(error_msg), "incorrect magic");
+        goto corrupt;
+    }
+    if (header.state_size != nes_state_size() || header.interval == 0)
+    {
+        snprintf(error_msg, sizeof(error_msg), "state size $%X does not match this build ($%zX)",
+            header.state_size, nes_state_size());
+        goto corrupt;
+    }
+
+    // Read the states into the snapshot store.
+    struct keyframes* keyframes = keyframes_alloc(header.rom_crc32, header.movie_crc32, header.interval);
+    if (header.count)
+    {
+        keyframes->snapshots = safe_calloc(header.count, sizeof(uint32_t));
+        keyframes->capacity = header.count;
+        uint8_t* state = safe_malloc(keyframes->state_size);
+        while (keyframes->count < header.count && fread(state, keyframes->state_size, 1, file) == 1)
+            keyframes->snapshots[keyframes->count++] = snapshot_put(keyframes->store, state);
+        free(state);
+        if (keyframes->count != header.count)
+        {
+            snprintf(error_msg, sizeof(error_msg), "expected %u keyframes, got %u", 
+                header.count, keyframes->count);
+            keyframes_free(keyframes);
+            goto corrupt;
+        }
+    }
+    fclose(file);
+    return keyframes;
+
+corrupt:
+    fclose(file);
+    return NULL;
+}
+
+// Create a new, empty keyframes instance.
+struct keyframes* keyframes_alloc(uint32_t rom_crc32, uint32_t movie_crc32, uint32_t interval)
+{
+    assert(interval);
+    struct keyframes* keyframes = safe_malloc(sizeof(struct keyframes));
+    keyframes->rom_crc32 = rom_crc32;
+    keyframes->movie_crc32 = movie_crc32;
+    keyframes->interval = interval;
+    keyframes->state_size = nes_state_size();
+    keyframes->store = snapshot_store_alloc(keyframes->state_size);
+    return keyframes;
+}
+
+// Free a keyframes instance.
+void keyframes_free(struct keyframes* keyframes)
+{
+    if (keyframes == NULL)
+        return;
+    snapshot_store_free(keyframes->store);
+    free(keyframes->snapshots);
+    free(keyframes);
+}
+
+// Get the keyframes error message.
+const char* keyframes_error_msg()
+{
+    return error_msg;
+}
\ No newline at end of file
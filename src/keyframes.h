@@ -0,0 +1,52 @@
+/*
+; Movie keyframes: save states captured at a fixed frame interval during movie
+; playback, so that any frame of a long movie can be sought to quickly.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "nes.h"
+#include "snapshot.h"
+
+// Keyframes struct definition.
+struct keyframes
+{
+    uint32_t rom_crc32;         // CRC-32 of the iNES file the keyframes belong to.
+    uint32_t movie_crc32;       // CRC-32 of the movie they belong to (movie_crc32()).
+    uint32_t interval;          // A keyframe is captured every this many frames.
+    size_t state_size;          // Size of each keyframe (nes_state_size()).
+
+    // Keyframe n holds the state at the start of frame n * interval. Only a
+    // contiguous run of keyframes from frame 0 is kept. The states are held in a
+    // snapshot store, so that the pages they have in common are only kept once.
+    struct snapshot_store* store;
+    uint32_t* snapshots;        // Snapshot ID of each keyframe.
+    uint32_t count;
+    uint32_t capacity;
+};
+
+// Capture the state at the start of the given frame, if it falls on the keyframe
+// interval and hasn't been captured yet.
+void keyframes_capture(struct keyframes* keyframes, struct nes* computer, uint32_t frame);
+
+// Restore the latest keyframe at or before the given frame. Returns the frame
+// number that the computer has been restored to.
+uint32_t keyframes_seek(struct keyframes* keyframes, struct nes* computer, uint32_t frame);
+
+// Save the keyframes to a sidecar file. Returns false on failure.
+bool keyframes_save(struct keyframes* keyframes, const char* path);
+
+// Load keyframes from a sidecar file. Returns NULL on failure; see keyframes_error_msg().
+struct keyframes* keyframes_load(const char* path);
+
+// Create a new, empty keyframes instance.
+struct keyframes* keyframes_alloc(uint32_t rom_crc32, uint32_t movie_crc32, uint32_t interval);
+
+// Free a keyframes instance.
+void keyframes_free(struct keyframes* keyframes);
+
+// Get the keyframes error message.
+const char* keyframes_error_msg();
\ No newline at end of file
@@ -5,6 +5,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <memory.h>
 #include <time.h>
 
@@ -12,34 +13,329 @@
 
 #include "constants.h"
 #include "util.h"
+#include "audio.h"
+#include "triple_buffer.h"
+#include "movie.h"
+#include "keyframes.h"
+#include "replay.h"
+#include "explore.h"
+#include "batch.h"
+#include "dump.h"
+#include "framelog.h"
+#include "observe.h"
+#include "stream.h"
+#include "trace.h"
+#include "profile.h"
+#include "cpu_profile.h"
 #include "nes.h"
 
+// Default audio output settings.
+#define AUDIO_FREQUENCY         44100   // 44.1KHz
+#define AUDIO_DEVICE_SAMPLES    512     // ~11.6ms per device buffer
+#define AUDIO_MIN_SAMPLES       256
+#define AUDIO_MAX_SAMPLES       8192
+#define AUDIO_RING_BUFFERS      4       // The ring holds this many device buffers.
+
+// Frame pacing.
+#define MAX_PACING_LAG          (NANOSECOND / 10)
+
+// Movie seeking.
+#define KEYFRAME_INTERVAL       300     // 5 seconds
+#define SEEK_STEP               600     // Frames skipped by the seek hotkeys (10 seconds).
+
+// Fast-forward speed multipliers. SPEED_UNLIMITED runs the emulation flat out.
+#define SPEED_NORMAL            1
+#define SPEED_UNLIMITED         0
+#define SPEED_DEFAULT_TURBO     4
+#define PRESENT_INTERVAL        (NANOSECOND / 60)   // Unlimited speed presents at ~60Hz.
+
+// Random input exploration.
+#define EXPLORE_FRAMES          600     // Default length of each branch (10 seconds).
+#define EXPLORE_HOLD            8       // Random buttons are held for this many frames.
+#define EXPLORE_VISITED_MAX     0x600000    // Most states pruning keeps track of (64 MiB).
+
+// Observation size, as most agents learning from the screen take it.
+#define OBSERVE_W               84
+#define OBSERVE_H               84
+
+// Number of frames a stream holds, so that readers have a few frames' time to take one.
+#define STREAM_SLOTS            4
+
+// Command-line options.
+struct nes_options
+{
+    const char* rom_path;       // The iNES ROM file to run.
+    unsigned audio_samples;     // Size of the audio device buffer, in samples.
+    unsigned turbo_speed;       // Fast-forward speed multiplier (SPEED_UNLIMITED: no limit).
+    unsigned frameskip;         // Present every Nth frame while fast-forwarding (0: automatic).
+    bool turbo;                 // Start in fast-forward.
+    const char* record_path;    // Record an input movie to this file.
+    const char* play_path;      // Play back an input movie from this file.
+    bool headless;              // Run without a window or audio, as fast as possible.
+    uint32_t frames;            // Number of frames to run headless (0: until the movie ends).
+    const char* keyframes_path; // Load/save movie keyframes from/to this sidecar file.
+    uint32_t keyframe_interval; // Capture a keyframe every this many frames of playback.
+    uint32_t seek;              // Seek to this frame of the movie on start-up.
+    const char* export_path;    // Render every frame of the movie to this file.
+    unsigned jobs;              // Number of threads rendering the export (0: one per CPU).
+    const char* dump_video_path;// Dump every frame to this YUV4MPEG2 file ("-": stdout).
+    const char* dump_audio_path;// Dump the audio to this WAV file ("-": stdout).
+    const char* framelog_path;  // Log every frame's palette indices, RAM and input to this file.
+    const char* observe_path;   // Write every frame's greyscale observation to this file.
+    const char* stream_name;    // Stream every frame to shared memory of this name.
+    uint32_t profile_interval;  // Print a profile every this many frames (0: on exit only).
+    const char* cpu_profile_path;   // Write the game code profile report to this file.
+    const char* callgrind_path;     // Write the game code profile in callgrind format to this file.
+    const char* trace_path;     // Trace the CPU, saving the last instructions to this file.
+    uint32_t trace_records;     // Number of instructions kept in the trace.
+    bool memory_report;         // Print how much memory the emulated machine takes up.
+    uint32_t explore;           // Number of random input branches to explore (0: none).
+    int32_t explore_score;      // RAM address whose value scores each branch (-1: none).
+    int32_t explore_goal;       // End a branch once its score reaches this (-1: never).
+    bool explore_prune;         // End branches that repeat a state and input another has run.
+    uint32_t batch;             // Number of lanes to run headless in a lockstep batch (0: none).
+};
+static struct nes_options options = 
+{
+    .audio_samples = AUDIO_DEVICE_SAMPLES,
+    .turbo_speed = SPEED_DEFAULT_TURBO,
+    .keyframe_interval = KEYFRAME_INTERVAL,
+    .trace_records = TRACE_DEFAULT_RECORDS,
+    .explore_score = -1,
+    .explore_goal = -1
+};
+
+// A frame the emulation thread can render into: a streaming texture, plus its
+// pixels/pitch while it is locked.
+struct frame_target
+{
+    SDL_Texture* texture;
+    void* pixels;
+    int pitch;
+};
+
 // Create display information for this current session.
 struct nes_display_data
 {
     // SDL data.
     SDL_Window* window;         // The window itself.    
     SDL_Renderer* renderer;     // The renderer used for the window.
-    SDL_Texture* buffer;        // The buffer that is being manipulated by the emulator.
-    SDL_AudioDeviceID audio;    // The audio device to queue samples into.
+    SDL_AudioDeviceID audio;    // The audio device draining the audio ring.
+    struct audio_ring* audio_ring;
+    bool audio_active;          // Whether the emulation speed is slaved to the audio ring.
+    double audio_sample_debt;   // Fractional number of samples owed to the audio ring.
     unsigned w;                 // The current display width.
     unsigned h;                 // The current display height.
 
+    // Emulation thread data. The emulation thread owns the NES computer; the main
+    // thread only ever talks to it through the fields below.
+    SDL_Thread* thread;
+    volatile uint32_t running;  // Cleared by the main thread to stop the emulation thread.
+    volatile uint32_t input;    // Controller snapshot: port 0 in bits 0-7, port 1 in bits 8-15.
+    volatile uint32_t framerate;// Emulated frames per second, for the window title.
+    volatile uint32_t speed;    // Current speed multiplier (SPEED_NORMAL, 2/4/8 or SPEED_UNLIMITED).
+    volatile uint32_t seek;     // Frame to seek to, plus one (0: no seek requested).
+    volatile uint32_t save_trace;   // Set by the main thread to have the trace saved.
+    Uint32 frame_event;         // Pushed by the emulation thread when a frame is published.
+
+    // Frame targets, swapped through a triple buffer. The back and middle targets are
+    // always kept locked, so that the PPU can write straight into texture memory;
+    // only the front target is unlocked, uploaded and presented.
+    struct triple_buffer frames;
+    struct frame_target targets[3];
+
     // NES data.
     struct nes* computer;
     struct cartridge* cartridge;
+    const uint8_t* ines_data;   // The iNES file, mapped into memory.
+    size_t ines_size;
+    struct agbr8888* screen;    // Screen buffer for headless runs that need the pixels.
+    volatile uint32_t frame;    // Number of frames emulated since power-on.
+
+    // Input movies.
+    struct movie* playback;     // Overrides the live input while playing.
+    struct movie* recording;
+    struct keyframes* keyframes;// Captured while playing back, for seeking.
+
+    // Audio/video dump.
+    struct dump* dump;
+    double dump_sample_debt;    // Fractional number of samples owed to the dump.
+    struct framelog_writer* framelog;
+    struct trace* trace;
+
+    // Observations, made from the frame log's palette indices if it is running, or
+    // else from observe_indices.
+    struct observe* observe;
+    FILE* observe_file;
+    uint8_t* observe_indices;
+    uint32_t observations;      // Number of observations written.
+
+    // Shared-memory frame stream. The PPU renders into its slots, and the frame
+    // target gets a copy.
+    struct stream* stream;
+#ifdef NES_PROFILE
+    struct cpu_profile* cpu_profile;
+#endif
 };
 static struct nes_display_data display;
 
+// Status messages go to stdout, unless the dump is being written there.
+static FILE* messages;
+
+// The APU has not been emulated yet, so the audio output is silence for now. This
+// still keeps the audio clock running at the correct rate.
+static const int16_t silence[1024];
+
+#ifdef NES_PROFILE
+// Write the game code profile to a file, as a text report or in callgrind format.
+static void write_cpu_profile(const char* path, bool callgrind)
+{
+    if (path == NULL)
+        return;
+    FILE* file = fopen(path, "w");
+    bool written = file && (callgrind ? cpu_profile_callgrind(display.cpu_profile, options.rom_path, file)
+        : cpu_profile_report(display.cpu_profile, file));
+    if (file && fclose(file))
+        written = false;
+    if (written)
+        fprintf(messages, "cpu profile: wrote %s\n", path);
+    else
+        fprintf(stderr, "cpu profile: could not write %s\n", path);
+}
+#endif
+
+// Save the CPU trace to its file.
+static void save_trace()
+{
+    if (trace_save(display.trace, options.trace_path))
+        fprintf(messages, "trace: saved the last %u instruction(s) to %s\n", trace_size(display.trace),
+            options.trace_path);
+    else
+        fprintf(stderr, "trace: could not write %s\n", options.trace_path);
+}
+
 // Unload SDL on process exit.
 static void process_exit()
 {
+    // Stop the emulation thread before anything it uses is released.
+    if (display.thread)
+    {
+        atomic_store_u32(&display.running, false);
+        SDL_WaitThread(display.thread, NULL);
+        display.thread = NULL;
+    }
+
+    // Save the movie being recorded.
+    if (display.recording)
+    {
+        if (movie_save(display.recording, options.record_path))
+            fprintf(messages, "movie: recorded %u frame(s) to %s\n", display.recording->frame_count, options.record_path);
+        else
+            fprintf(stderr, "movie: could not write %s\n", options.record_path);
+    }
+    movie_free(display.recording);
+    movie_free(display.playback);
+
+    // Print the profile of whatever has run since the last report.
+    profile_report();
+
+    // Save the trace of whatever ran last.
+    if (display.trace)
+    {
+        nes_settrace(display.computer, NULL);
+        save_trace();
+        trace_free(display.trace);
+        display.trace = NULL;
+    }
+
+    // Write the game code profile.
+#ifdef NES_PROFILE
+    if (display.cpu_profile)
+    {
+        nes_setprofile(display.computer, NULL);
+        write_cpu_profile(options.cpu_profile_path, false);
+        write_cpu_profile(options.callgrind_path, true);
+        cpu_profile_free(display.cpu_profile);
+        display.cpu_profile = NULL;
+    }
+#endif
+
+    // Flush the dump.
+    if (display.dump && !dump_free(display.dump))
+        fprintf(stderr, "dump: %s\n", dump_error_msg());
+    display.dump = NULL;
+
+    // Finish the frame log.
+    if (display.framelog)
+    {
+        uint32_t frame_count = display.framelog->frame_count;
+        uint64_t size = display.framelog->offset;
+        if (framelog_writer_free(display.framelog))
+            fprintf(messages, "framelog: logged %u frame(s) to %s (%.1f bytes/frame)\n", frame_count, 
+                options.framelog_path, frame_count ? (double)size / frame_count : 0.0);
+        else
+            fprintf(stderr, "framelog: %s\n", framelog_error_msg());
+        display.framelog = NULL;
+    }
+
+    // Stop streaming. Readers keep what they have mapped.
+    if (display.stream)
+    {
+        fprintf(messages, "stream: streamed %llu frame(s)\n", (unsigned long long)display.stream->header->published);
+        stream_free(display.stream);
+        display.stream = NULL;
+    }
+
+    // Finish the observations.
+    if (display.observe_file)
+    {
+        if (fclose(display.observe_file) == 0)
+            fprintf(messages, "observe: wrote %u %ux%u observation(s) to %s\n", display.observations,
+                display.observe->w, display.observe->h, options.observe_path);
+        else
+            fprintf(stderr, "observe: could not write %s\n", options.observe_path);
+        display.observe_file = NULL;
+    }
+
+    // Save the keyframes to their sidecar file, so that the next seek is instant.
+    if (display.keyframes && options.keyframes_path && !keyframes_save(display.keyframes, options.keyframes_path))
+        fprintf(stderr, "keyframes: could not write %s\n", options.keyframes_path);
+    if (options.memory_report)
+    {
+        size_t size;
+        free(nes_hibernate(display.computer, &size));
+        fprintf(messages, "memory: the machine hibernates to %zu bytes\n", size);
+    }
+    if (display.keyframes && options.memory_report)
+    {
+        struct snapshot_report report;
+        snapshot_store_report(display.keyframes->store, &report);
+        fprintf(messages, "memory: %u keyframe(s) of %zu bytes held in %zu bytes (%u distinct page(s))\n",
+            report.snapshots, report.logical, report.stored, report.pages);
+    }
+    keyframes_free(display.keyframes);
+
     // Clear up the NES emulator.
     nes_free(display.computer);
     cartridge_free(display.cartridge);
+    unmap_file(display.ines_data, display.ines_size);
+    free(display.screen);
+    observe_free(display.observe);
+    free(display.observe_indices);
+
+    // Stop the audio callback before its ring is released.
+    if (display.audio)
+        SDL_CloseAudioDevice(display.audio);
+    if (display.audio_ring)
+    {
+        fprintf(messages, "audio: %u underrun(s), %u overrun(s)\n", display.audio_ring->underruns, 
+            display.audio_ring->overruns);
+        audio_ring_free(display.audio_ring);
+    }
 
     // Clear up SDL.
-    SDL_DestroyTexture(display.buffer);
+    for (int i = 0; i < 3; ++i)
+        SDL_DestroyTexture(display.targets[i].texture);
     SDL_DestroyRenderer(display.renderer);
     SDL_DestroyWindow(display.window);
     SDL_Quit();
@@ -49,10 +345,32 @@ static void process_exit()
 static void sdl_error()
 {
     char error_msg[256];
-    printf("SDL ERROR CAUGHT: %s\n", SDL_GetErrorMsg(error_msg, sizeof(error_msg)));
+    fprintf(stderr, "SDL ERROR CAUGHT: %s\n", SDL_GetErrorMsg(error_msg, sizeof(error_msg)));
     exit(EXIT_FAILURE);
 }
 
+// Work out how many audio samples are owed for the given number of PPU cycles, carrying
+// over the fractional part in the debt so that the long-run sample rate stays exact.
+static uint32_t audio_samples_owed(uint32_t ppu_cycles, double* debt)
+{
+    *debt += (double)ppu_cycles * AUDIO_FREQUENCY / ((double)MASTER_CLOCK / 4);
+    uint32_t count = (uint32_t)*debt;
+    *debt -= count;
+    return count;
+}
+
+// Feed the audio ring with the samples produced over the given number of PPU cycles.
+static void update_audio(uint32_t ppu_cycles)
+{
+    uint32_t count = audio_samples_owed(ppu_cycles, &display.audio_sample_debt);
+    while (count)
+    {
+        uint32_t chunk = min(count, (uint32_t)(sizeof(silence) / sizeof(silence[0])));
+        audio_ring_write(display.audio_ring, silence, chunk);
+        count -= chunk;
+    }
+}
+
 // Update the renderer.
 static void update_render()
 {
@@ -63,58 +381,872 @@ static void update_render()
 
     // Calculate the rect that the display should be drawn onto and re-draw the display.
     struct SDL_Rect rect = {(w - display.w) / 2, (h - display.h) / 2, display.w, display.h};
+    struct frame_target* front = triple_buffer_front(&display.frames);
     SDL_RenderClear(display.renderer);
-    SDL_RenderCopy(display.renderer, display.buffer, NULL, &rect);
+    SDL_RenderCopy(display.renderer, front->texture, NULL, &rect);
     SDL_RenderPresent(display.renderer);
 }
 
-// A separate event watch is needed to handle window resizing.
-static int watcher(void* userdata, SDL_Event* event)
+// Lock a frame target so that it can be rendered into.
+static void lock_target(struct frame_target* target)
+{
+    if (SDL_LockTexture(target->texture, NULL, &target->pixels, &target->pitch) != 0)
+        sdl_error();
+}
+
+// Unlock a frame target, uploading its contents.
+static void unlock_target(struct frame_target* target)
 {
-    // If this is not a window event, continue.
-    if (event->type != SDL_WINDOWEVENT)
-        return 0;
+    SDL_UnlockTexture(target->texture);
+    target->pixels = NULL;
+}
 
-    // Get the current window event type.
-    switch (event->window.event)
+// Present the most recently published frame, if there is one.
+static void present_frame()
+{
+    // The current front target becomes the middle one once swapped out, so it must be
+    // locked again before the emulation thread can get hold of it.
+    if (!triple_buffer_fresh(&display.frames))
+        return;
+    PROFILE_BEGIN(present_start);
+    lock_target(triple_buffer_front(&display.frames));
+    triple_buffer_consume(&display.frames);
+    unlock_target(triple_buffer_front(&display.frames));
+    update_render();
+    PROFILE_END(present_start, PROFILE_PRESENT);
+}
+
+// Map a key to the controller input it is bound to, if any.
+static uint8_t key_input(SDL_Scancode scancode)
+{
+    switch ((int)scancode)
+    {
+    case SDL_SCANCODE_X:        return INPUT_A;
+    case SDL_SCANCODE_Z:        return INPUT_B;
+    case SDL_SCANCODE_A:        return INPUT_SELECT;
+    case SDL_SCANCODE_S:        return INPUT_START;
+    case SDL_SCANCODE_UP:       return INPUT_UP;
+    case SDL_SCANCODE_DOWN:     return INPUT_DOWN;
+    case SDL_SCANCODE_LEFT:     return INPUT_LEFT;
+    case SDL_SCANCODE_RIGHT:    return INPUT_RIGHT;
+    }
+    return 0;
+}
+
+// Emulate a frame straight into the next slot of the stream and publish it, then copy
+// it to the frame target, if there is one and the frame is presented or dumped.
+static void stream_frame(struct nes* computer, bool render_skip)
+{
+    void* target = computer->screen;
+    size_t target_pitch = computer->screen_pitch;
+    size_t pitch;
+    void* pixels = stream_begin(display.stream, &pitch);
+    nes_setscreen(computer, pixels, pitch);
+    nes_frame(computer);
+    stream_publish(display.stream, display.frame, computer->controllers, computer->ram);
+    if (target && (!render_skip || display.dump))
+    {
+        for (int y = 0; y < NES_H; ++y)
+            memcpy((uint8_t*)target + y * target_pitch, (uint8_t*)pixels + y * pitch, NES_W * sizeof(struct agbr8888));
+    }
+    nes_setscreen(computer, target, target_pitch);
+}
+
+// Emulate a single frame. Movie playback overrides the current controller input, and
+// whatever input ends up being used is appended to the movie being recorded.
+static void emulate_frame(bool render_skip)
+{
+    struct nes* computer = display.computer;
+
+    // Apply the movie input, if any, capturing keyframes along the way. Once the movie
+    // runs out, control is handed back to the live input, and keyframes stop being
+    // captured, as the states from then on depend on it.
+    if (display.playback)
+    {
+        if (display.frame < display.playback->frame_count)
+            keyframes_capture(display.keyframes, computer, display.frame);
+        if (!movie_input(display.playback, display.frame, computer->controllers)
+            && display.frame == display.playback->frame_count)
+            fprintf(messages, "movie: playback finished after %u frame(s)\n", display.frame);
+    }
+    if (display.recording)
+        movie_record(display.recording, computer->controllers);
+
+    // Clock the NES enough times to render a whole frame. Every frame is rendered
+    // while dumping, logging, observing or streaming frames.
+    computer->render_skip = render_skip && display.dump == NULL && display.framelog == NULL
+        && display.observe_file == NULL && display.stream == NULL;
+    if (display.stream)
+        stream_frame(computer, render_skip);
+    else
+        nes_frame(computer);
+
+    // Write the frame's observation. Observing stops if the file can't be written to.
+    if (display.observe_file)
     {
-    // The window is being resized - re-scale the display and update the rendered output.
-    case SDL_WINDOWEVENT_RESIZED:
-        float scale = min((float)event->window.data1 / NES_W, (float)event->window.data2 / NES_H);
-        display.w = NES_W * scale;
-        display.h = NES_H * scale;
-        update_render();
-        break;
+        uint8_t observation[OBSERVE_W * OBSERVE_H];
+        observe_frame(display.observe, computer->screen_indices, observation);
+        if (fwrite(observation, sizeof(observation), 1, display.observe_file) == 1)
+            display.observations++;
+        else
+        {
+            fprintf(stderr, "observe: could not write %s; observing stopped\n", options.observe_path);
+            fclose(display.observe_file);
+            display.observe_file = NULL;
+        }
+    }
+
+    // Log the frame. Logging stops if the frame log can't be written to.
+    if (display.framelog && !framelog_write(display.framelog, display.frame, computer->controllers, computer->ram))
+    {
+        fprintf(stderr, "framelog: %s; logging stopped\n", framelog_error_msg());
+        nes_setindices(computer, display.observe_indices);
+        framelog_writer_free(display.framelog);
+        display.framelog = NULL;
+    }
+    display.frame++;
+    profile_frame();
+
+    // Dump the frame, along with the audio produced over it.
+    if (display.dump)
+    {
+        dump_video(display.dump, computer->screen, computer->screen_pitch);
+        uint32_t count = audio_samples_owed(computer->ppu.frame_cycles_enumerated, &display.dump_sample_debt);
+        while (count)
+        {
+            uint32_t chunk = min(count, (uint32_t)(sizeof(silence) / sizeof(silence[0])));
+            dump_audio(display.dump, silence, chunk);
+            count -= chunk;
+        }
+    }
+}
+
+// Seek to the start of the given frame of the movie being played back. The nearest
+// earlier keyframe is restored, and the remaining frames are emulated with rendering
+// skipped. A movie being recorded is truncated to the frame sought to, so that
+// recording branches off from there.
+static void seek_frame(uint32_t frame)
+{
+    // Restore a keyframe if the target is behind us, or if the keyframe is closer to
+    // the target than we currently are. Keyframe 0 is always captured, so seeking
+    // backwards is always possible.
+    struct keyframes* keyframes = display.keyframes;
+    if (keyframes->count)
+    {
+        uint32_t nearest = min(frame / keyframes->interval, keyframes->count - 1) * keyframes->interval;
+        if (frame < display.frame || nearest > display.frame)
+            display.frame = keyframes_seek(keyframes, display.computer, frame);
+    }
+    if (display.recording)
+        movie_truncate(display.recording, display.frame);
+
+    // Emulate the rest of the way.
+    while (display.frame < frame)
+        emulate_frame(true);
+}
+
+// Change the emulation speed. Audio is muted while fast-forwarding.
+static void set_speed(uint32_t speed)
+{
+    atomic_store_u32(&display.speed, speed);
+    SDL_PauseAudioDevice(display.audio, speed != SPEED_NORMAL);
+}
+
+// Handle the fast-forward, seek and trace hotkeys. Tab toggles fast-forward; F1-F5 select
+// 1x, 2x, 4x, 8x or unlimited speed; F9/F10 seek 10 seconds back/forward through the movie
+// being played back; F8 saves the CPU trace. Returns false if the key isn't a hotkey.
+static bool hotkey(SDL_Scancode scancode)
+{
+    static const uint32_t speeds[] = {SPEED_NORMAL, 2, 4, 8, SPEED_UNLIMITED};
+    uint32_t speed = atomic_load_u32(&display.speed);
+    switch ((int)scancode)
+    {
+    case SDL_SCANCODE_TAB:
+        set_speed(speed == SPEED_NORMAL ? options.turbo_speed : SPEED_NORMAL);
+        return true;
+    case SDL_SCANCODE_F9:
+    case SDL_SCANCODE_F10:
+    {
+        // Seek backwards/forwards through the movie being played back.
+        uint32_t frame = atomic_load_u32(&display.frame);
+        if (scancode == SDL_SCANCODE_F9)
+            frame = frame > SEEK_STEP ? frame - SEEK_STEP : 0;
+        else
+            frame += SEEK_STEP;
+        if (display.playback)
+            atomic_store_u32(&display.seek, frame + 1);
+        return true;
+    }
+    case SDL_SCANCODE_F8:
+        atomic_store_u32(&display.save_trace, true);
+        return true;
+    case SDL_SCANCODE_F1:
+    case SDL_SCANCODE_F2:
+    case SDL_SCANCODE_F3:
+    case SDL_SCANCODE_F4:
+    case SDL_SCANCODE_F5:
+        speed = speeds[scancode - SDL_SCANCODE_F1];
+        if (speed != SPEED_NORMAL)
+            options.turbo_speed = speed;
+        set_speed(speed);
+        return true;
+    }
+    return false;
+}
+
+// Emulation thread. This runs the NES computer at its native frame rate and publishes
+// every finished frame through the triple buffer, so that a stalled present or a burst
+// of window events on the main thread never holds up the emulation.
+static int emulate(void* userdata)
+{
+    uint64_t timestamp = get_ns_timestamp();
+    uint64_t deadline = timestamp;
+    uint64_t present_timestamp = 0;
+    uint32_t frames_skipped = 0;
+    float cached_framerate = 0.f;
+    bool first_frame_rendered = false;
+    while (atomic_load_u32(&display.running))
+    {
+        // Sleep until the time length of the previous PPU frame has passed. While audio
+        // is playing, the frame length is stretched or shrunk slightly depending on how
+        // full the audio ring is, so that the emulation is slaved to the audio clock.
+        // While fast-forwarding, the frame length is divided by the speed multiplier
+        // instead, or not waited for at all when unlimited.
+        static double ns_per_ppu_cycle = (double)NANOSECOND / ((double)MASTER_CLOCK / 4);
+        uint32_t speed = atomic_load_u32(&display.speed);
+        if (speed == SPEED_UNLIMITED)
+            deadline = get_ns_timestamp();
+        else if (display.computer->ppu.frame_complete)
+        {
+            double ratio = (display.audio_active && speed == SPEED_NORMAL) 
+                ? audio_ring_rate_control(display.audio_ring) : 1.0 / speed;
+            deadline += (uint64_t)(display.computer->ppu.frame_cycles_enumerated * ns_per_ppu_cycle * ratio);
+
+            // If the emulation has fallen far behind, don't try to catch up; just start
+            // pacing from now.
+            uint64_t now = get_ns_timestamp();
+            if (now > deadline + MAX_PACING_LAG)
+                deadline = now;
+            else
+                sleep_until_ns(deadline);
+        }
+        uint64_t new_timestamp = get_ns_timestamp();
+
+        // Calculate the framerate; the main thread picks it up for the window title.
+        if (first_frame_rendered)
+        {
+            cached_framerate = lerp(cached_framerate, 
+                1 / ((float)(new_timestamp - timestamp) / NANOSECOND), 
+                min(max(1 / cached_framerate * 2, 0), 1));
+            atomic_store_u32(&display.framerate, (uint32_t)cached_framerate);
+        }
+
+        // Carry out a pending seek.
+        uint32_t seek = atomic_exchange_u32(&display.seek, 0);
+        if (seek)
+            seek_frame(seek - 1);
+
+        // Save the trace, if asked to.
+        if (atomic_exchange_u32(&display.save_trace, false) && display.trace)
+            save_trace();
+
+        // Latch the controller input for this frame.
+        uint32_t input = atomic_load_u32(&display.input);
+        display.computer->controllers[0].value = input & 0xFF;
+        display.computer->controllers[1].value = (input >> 8) & 0xFF;
+
+        // While fast-forwarding, only every Nth frame is presented (or, when unlimited
+        // with automatic frameskip, one frame per display refresh), and the PPU skips
+        // composing the rest entirely.
+        bool present = true;
+        if (speed != SPEED_NORMAL)
+        {
+            if (speed == SPEED_UNLIMITED && options.frameskip == 0)
+                present = new_timestamp - present_timestamp >= PRESENT_INTERVAL;
+            else
+                present = ++frames_skipped >= (options.frameskip ? options.frameskip : speed);
+        }
+        if (present)
+        {
+            frames_skipped = 0;
+            present_timestamp = new_timestamp;
+        }
+
+        // Emulate the frame, straight into the back frame target.
+        struct frame_target* target = triple_buffer_back(&display.frames);
+        nes_setscreen(display.computer, target->pixels, target->pitch);
+        emulate_frame(!present);
+        timestamp = new_timestamp;
+        first_frame_rendered = true;
+
+        // Audio is muted while fast-forwarding.
+        if (speed == SPEED_NORMAL)
+            update_audio(display.computer->ppu.frame_cycles_enumerated);
+        if (!present)
+            continue;
+
+        // Publish the frame and let the main thread know about it.
+        triple_buffer_publish(&display.frames);
+        SDL_Event event;
+        memset(&event, 0, sizeof(event));
+        event.type = display.frame_event;
+        SDL_PushEvent(&event);
     }
 
     // Exit.
     return 0;
 }
 
+// Run without a window or audio, as fast as possible, then report how long it took.
+// Together with movie playback, this gives a reproducible benchmark.
+static void run_headless()
+{
+    uint32_t frames = options.frames ? options.frames : display.playback->frame_count;
+    uint32_t first_frame = display.frame;
+    uint64_t start = get_ns_timestamp();
+    while (display.frame < frames)
+        emulate_frame(true);
+    uint64_t elapsed = get_ns_timestamp() - start;
+
+    // Report the run. The RAM checksum makes it easy to tell whether two runs of the
+    // same movie ended up in the same state.
+    fprintf(messages, "headless: %u frame(s) in %.3fs (%.1ffps), RAM CRC-32 %08X\n", display.frame - first_frame,
+        (double)elapsed / NANOSECOND, (display.frame - first_frame) / ((double)elapsed / NANOSECOND),
+        crc32(0, display.computer->ram, sizeof(display.computer->ram)));
+}
+
+// Run a lockstep batch of machines from power-on without a window or audio (see
+// batch.c), then report how long it took. Lane 0 gets the movie input, if any; each
+// other lane gets the same input up to a random frame, and random input after it,
+// like rollouts branching off a common run.
+static void run_batch()
+{
+    uint32_t frames = options.frames ? options.frames : display.playback->frame_count;
+    struct batch* batch = batch_alloc(display.cartridge, options.batch);
+    uint8_t* inputs = safe_calloc(batch->lane_count, 2);
+    uint32_t* branch_frames = safe_calloc(batch->lane_count, sizeof(uint32_t));
+    for (uint32_t lane = 1; lane < batch->lane_count && frames; ++lane)
+        branch_frames[lane] = (uint32_t)rand() % frames;
+    uint64_t start = get_ns_timestamp();
+    for (uint32_t frame = 0; frame < frames; ++frame)
+    {
+        union controller controllers[2] = { { .value = 0 }, { .value = 0 } };
+        if (display.playback)
+            movie_input(display.playback, frame, controllers);
+        for (uint32_t lane = 0; lane < batch->lane_count; ++lane)
+        {
+            if (lane == 0 || frame < branch_frames[lane])
+            {
+                inputs[lane * 2 + 0] = controllers[0].value;
+                inputs[lane * 2 + 1] = controllers[1].value;
+            }
+            else if (frame % EXPLORE_HOLD == 0)
+                inputs[lane * 2] = (uint8_t)rand();
+        }
+        batch_step(batch, inputs);
+    }
+    uint64_t elapsed = get_ns_timestamp() - start;
+
+    // Report the run. Lane 0 ends up just where a plain headless run would.
+    fprintf(messages, "batch: %u lane(s) of %u frame(s) in %.3fs (%.1f lane fps), %.1f%% emulated, "
+        "lane 0 RAM CRC-32 %08X\n", batch->lane_count, frames, (double)elapsed / NANOSECOND,
+        batch->lane_frames / ((double)elapsed / NANOSECOND), 100.0 * batch->emulated_frames / max(batch->lane_frames, 1),
+        crc32(0, batch->lanes[0].ram, sizeof(batch->lanes[0].ram)));
+    free(branch_frames);
+    free(inputs);
+    batch_free(batch);
+}
+
+// Write an exported frame out as raw ABGR8888 pixels.
+static void export_frame(void* userdata, uint32_t frame, const struct agbr8888* pixels)
+{
+    fwrite(pixels, sizeof(struct agbr8888), NES_W * NES_H, userdata);
+}
+
+// Render every frame of the movie being played back to a file, then report how long
+// it took. The frames are rendered in parallel; see replay.c.
+static bool run_export()
+{
+    FILE* file = fopen(options.export_path, "wb");
+    if (file == NULL)
+    {
+        fprintf(stderr, "export: could not write %s\n", options.export_path);
+        return false;
+    }
+
+    // Render the frames.
+    uint32_t frames = display.playback->frame_count;
+    if (options.frames)
+        frames = min(frames, options.frames);
+    uint64_t start = get_ns_timestamp();
+    bool success = replay_render(display.computer, display.playback, frames, REPLAY_SEGMENT_FRAMES,
+        options.jobs, export_frame, file);
+    uint64_t elapsed = get_ns_timestamp() - start;
+    fclose(file);
+    if (!success)
+    {
+        fprintf(stderr, "export: %s\n", replay_error_msg());
+        return false;
+    }
+    fprintf(messages, "export: %u frame(s) of %ux%u ABGR8888 to %s in %.3fs (%.1ffps)\n", frames, NES_W, NES_H,
+        options.export_path, (double)elapsed / NANOSECOND, frames / ((double)elapsed / NANOSECOND));
+    return true;
+}
+
+// Score an explored branch by the value of a RAM byte, ending it once the goal is reached.
+static bool score_branch(void* userdata, struct nes* computer, uint32_t frame, int64_t* score)
+{
+    *score = computer->ram[options.explore_score];
+    return options.explore_goal < 0 || *score < options.explore_goal;
+}
+
+// Run random input from the current state along a batch of branches in parallel (see
+// explore.c), then report the best one. If a movie is being recorded, the best branch
+// is appended to it.
+static bool run_explore()
+{
+    // Make up the input of each branch: random buttons on port 0, changing every
+    // EXPLORE_HOLD frames.
+    uint32_t count = options.explore;
+    uint32_t frames = options.frames ? options.frames : EXPLORE_FRAMES;
+    uint8_t* inputs = safe_calloc((size_t)count * frames, 2);
+    struct explore_branch* branches = safe_calloc(count, sizeof(struct explore_branch));
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        branches[i].inputs = inputs + (size_t)i * frames * 2;
+        branches[i].frame_count = frames;
+        uint8_t buttons = 0;
+        for (uint32_t frame = 0; frame < frames; ++frame)
+        {
+            if (frame % EXPLORE_HOLD == 0)
+                buttons = (uint8_t)rand();
+            inputs[((size_t)i * frames + frame) * 2] = buttons;
+        }
+    }
+
+    // Run the branches, keeping track of the states visited if duplicates are pruned.
+    // Past EXPLORE_VISITED_MAX states, the set is full, and every state that isn't in
+    // it counts as new.
+    struct state_set* visited = NULL;
+    if (options.explore_prune)
+        visited = state_set_alloc((uint32_t)min((uint64_t)count * frames, EXPLORE_VISITED_MAX));
+    uint64_t start = get_ns_timestamp();
+    bool success = explore_run(display.computer, branches, count, options.jobs, visited,
+        options.explore_score >= 0 ? score_branch : NULL, NULL);
+    uint64_t elapsed = get_ns_timestamp() - start;
+    if (!success)
+    {
+        fprintf(stderr, "explore: %s\n", explore_error_msg());
+        goto cleanup;
+    }
+
+    // Pick the best branch: the highest score, reached in the fewest frames.
+    uint64_t total = 0;
+    uint32_t pruned = 0;
+    struct explore_branch* best = &branches[0];
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        total += branches[i].frames_run;
+        pruned += branches[i].pruned;
+        if (branches[i].score > best->score 
+            || (branches[i].score == best->score && branches[i].frames_run < best->frames_run))
+            best = &branches[i];
+    }
+    fprintf(messages, "explore: %u branch(es), %llu frame(s) in %.3fs (%.1ffps); best: branch %u, score %lld "
+        "after %u frame(s), RAM CRC-32 %08X\n", count, (unsigned long long)total, (double)elapsed / NANOSECOND,
+        total / ((double)elapsed / NANOSECOND), (uint32_t)(best - branches), (long long)best->score,
+        best->frames_run, crc32(0, best->ram, sizeof(best->ram)));
+    if (visited)
+        fprintf(messages, "explore: %u branch(es) pruned, %u distinct state(s) visited\n", pruned, visited->count);
+
+    // Record the best branch.
+    if (display.recording)
+    {
+        for (uint32_t frame = 0; frame < best->frames_run; ++frame)
+        {
+            union controller controllers[2];
+            controllers[0].value = best->inputs[frame * 2 + 0];
+            controllers[1].value = best->inputs[frame * 2 + 1];
+            movie_record(display.recording, controllers);
+        }
+    }
+
+    // Clean up.
+cleanup:
+    state_set_free(visited);
+    free(branches);
+    free(inputs);
+    return success;
+}
+
+// Parse the command-line options. Returns false if they are malformed.
+static bool parse_options(int argc, char** argv)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        // --audio-buffer N: size of the audio device buffer, in samples.
+        if (!strcmp(argv[i], "--audio-buffer") && i + 1 < argc)
+        {
+            options.audio_samples = strtoul(argv[++i], NULL, 0);
+            if (options.audio_samples < AUDIO_MIN_SAMPLES || options.audio_samples > AUDIO_MAX_SAMPLES)
+            {
+                fprintf(stderr, "audio buffer size must be between %d and %d samples\n",
+                    AUDIO_MIN_SAMPLES, AUDIO_MAX_SAMPLES);
+                return false;
+            }
+        }
+
+        // --speed N: fast-forward speed multiplier (2, 4, 8, or 0 for unlimited). These
+        // are the speeds the hotkeys select from, so nothing else is accepted.
+        else if (!strcmp(argv[i], "--speed") && i + 1 < argc)
+        {
+            char* end;
+            options.turbo_speed = strtoul(argv[++i], &end, 10);
+            if (end == argv[i] || *end != '\0' || (options.turbo_speed != 2 && options.turbo_speed != 4
+                && options.turbo_speed != 8 && options.turbo_speed != SPEED_UNLIMITED))
+                return false;
+        }
+
+        // --frameskip N: present every Nth frame while fast-forwarding.
+        else if (!strcmp(argv[i], "--frameskip") && i + 1 < argc)
+            options.frameskip = strtoul(argv[++i], NULL, 0);
+
+        // --turbo: start in fast-forward.
+        else if (!strcmp(argv[i], "--turbo"))
+            options.turbo = true;
+
+        // --record FILE: record an input movie.
+        else if (!strcmp(argv[i], "--record") && i + 1 < argc)
+            options.record_path = argv[++i];
+
+        // --play FILE: play back an input movie.
+        else if (!strcmp(argv[i], "--play") && i + 1 < argc)
+            options.play_path = argv[++i];
+
+        // --headless: run without a window or audio.
+        else if (!strcmp(argv[i], "--headless"))
+            options.headless = true;
+
+        // --frames N: number of frames to run headless.
+        else if (!strcmp(argv[i], "--frames") && i + 1 < argc)
+            options.frames = strtoul(argv[++i], NULL, 0);
+
+        // --keyframes FILE: movie keyframes sidecar file.
+        else if (!strcmp(argv[i], "--keyframes") && i + 1 < argc)
+            options.keyframes_path = argv[++i];
+
+        // --keyframe-interval N: capture a keyframe every N frames of playback.
+        else if (!strcmp(argv[i], "--keyframe-interval") && i + 1 < argc)
+        {
+            if ((options.keyframe_interval = strtoul(argv[++i], NULL, 0)) == 0)
+                return false;
+        }
+
+        // --seek N: seek to frame N of the movie being played back.
+        else if (!strcmp(argv[i], "--seek") && i + 1 < argc)
+            options.seek = strtoul(argv[++i], NULL, 0);
+
+        // --export FILE: render every frame of the movie to a raw video file.
+        else if (!strcmp(argv[i], "--export") && i + 1 < argc)
+            options.export_path = argv[++i];
+
+        // --jobs N: number of threads rendering the export.
+        else if (!strcmp(argv[i], "--jobs") && i + 1 < argc)
+            options.jobs = strtoul(argv[++i], NULL, 0);
+
+        // --dump-video FILE: dump every frame as YUV4MPEG2 ("-": stdout).
+        else if (!strcmp(argv[i], "--dump-video") && i + 1 < argc)
+            options.dump_video_path = argv[++i];
+
+        // --dump-audio FILE: dump the audio as WAV ("-": stdout).
+        else if (!strcmp(argv[i], "--dump-audio") && i + 1 < argc)
+            options.dump_audio_path = argv[++i];
+
+        // --framelog FILE: log every frame's palette indices, RAM and input.
+        else if (!strcmp(argv[i], "--framelog") && i + 1 < argc)
+            options.framelog_path = argv[++i];
+
+        // --observe FILE: write every frame's 84x84 greyscale observation to FILE, raw.
+        else if (!strcmp(argv[i], "--observe") && i + 1 < argc)
+            options.observe_path = argv[++i];
+
+        // --stream NAME: stream every frame, with its input and RAM, to shared memory.
+        else if (!strcmp(argv[i], "--stream") && i + 1 < argc)
+            options.stream_name = argv[++i];
+
+        // --profile-interval N: print a profile every N frames (profiling builds only).
+        else if (!strcmp(argv[i], "--profile-interval") && i + 1 < argc)
+        {
+            options.profile_interval = strtoul(argv[++i], NULL, 0);
+#ifndef NES_PROFILE
+            fprintf(stderr, "profiler not compiled in; configure with -DNESEMU_PROFILE=ON\n");
+#endif
+        }
+
+        // --trace FILE: trace the CPU, saving the last instructions to FILE on exit and
+        // on F8 (see the nestrace tool).
+        else if (!strcmp(argv[i], "--trace") && i + 1 < argc)
+            options.trace_path = argv[++i];
+
+        // --trace-records N: keep the last N instructions in the trace.
+        else if (!strcmp(argv[i], "--trace-records") && i + 1 < argc)
+            options.trace_records = strtoul(argv[++i], NULL, 0);
+
+        // --memory-report: print how much memory the emulated machine takes up.
+        else if (!strcmp(argv[i], "--memory-report"))
+            options.memory_report = true;
+
+        // --explore N: run N branches of random input from the start (or --seek) state,
+        // each --frames long, in parallel; report the best and append it to --record.
+        else if (!strcmp(argv[i], "--explore") && i + 1 < argc)
+            options.explore = strtoul(argv[++i], NULL, 0);
+
+        // --explore-score ADDR: score each branch by the value of RAM byte ADDR.
+        else if (!strcmp(argv[i], "--explore-score") && i + 1 < argc)
+        {
+            if ((options.explore_score = (int32_t)strtoul(argv[++i], NULL, 0)) >= 0x800)
+                return false;
+        }
+
+        // --explore-goal N: end a branch as soon as its score reaches N.
+        else if (!strcmp(argv[i], "--explore-goal") && i + 1 < argc)
+            options.explore_goal = (int32_t)strtoul(argv[++i], NULL, 0);
+
+        // --explore-prune: end a branch as soon as it reaches a state any branch has
+        // already been to with the same input left to run.
+        else if (!strcmp(argv[i], "--explore-prune"))
+            options.explore_prune = true;
+
+        // --batch N: run N machines from power-on in a lockstep batch, headless.
+        else if (!strcmp(argv[i], "--batch") && i + 1 < argc)
+        {
+            options.batch = strtoul(argv[++i], NULL, 0);
+            options.headless = true;
+        }
+
+        // --cpu-profile FILE: write a report of the hot opcodes and addresses of the
+        // game code (profiling builds only).
+        // --callgrind FILE: write the same profile in callgrind format.
+        else if ((!strcmp(argv[i], "--cpu-profile") || !strcmp(argv[i], "--callgrind")) && i + 1 < argc)
+        {
+            if (!strcmp(argv[i], "--cpu-profile"))
+                options.cpu_profile_path = argv[++i];
+            else
+                options.callgrind_path = argv[++i];
+#ifndef NES_PROFILE
+            fprintf(stderr, "profiler not compiled in; configure with -DNESEMU_PROFILE=ON\n");
+#endif
+        }
+
+        // Anything else that isn't an option is the ROM path.
+        else if (argv[i][0] != '-' && options.rom_path == NULL)
+            options.rom_path = argv[i];
+        else
+            return false;
+    }
+    // A headless run needs to know when to stop.
+    if (options.headless && options.frames == 0 && options.play_path == NULL)
+        return false;
+
+    // Exports render a movie.
+    if (options.export_path && options.play_path == NULL)
+        return false;
+
+    // Only one of the dumps can go to stdout.
+    if (options.dump_video_path && options.dump_audio_path && !strcmp(options.dump_video_path, "-")
+        && !strcmp(options.dump_audio_path, "-"))
+        return false;
+
+    // The trace must hold something, and at most 2^31 instructions.
+    if (options.trace_records == 0 || options.trace_records > 0x80000000)
+        return false;
+    return options.rom_path != NULL;
+}
+
 // Top-level function.
 int main(int argc, char** argv)
 {
     // Before anything is initialized, the cartridge file should be read into
     // memory first. Check if it actually exists first.
-    if (argc < 2)
+    messages = stdout;
+    if (!parse_options(argc, argv))
         goto no_cartridge;
-    uint8_t* ines_data;
-    size_t ines_size;
-    FILE* ines = fopen(argv[1], "rb");
-    if (ines == NULL)
+    if ((options.dump_video_path && !strcmp(options.dump_video_path, "-"))
+        || (options.dump_audio_path && !strcmp(options.dump_audio_path, "-")))
+        messages = stderr;
+
+    // Map the cartridge file into memory. The cartridge points straight into the
+    // mapping, so the ROM is never copied, and is shared through the page cache with
+    // any other process running the same game.
+    const uint8_t* ines_data = display.ines_data = map_file(options.rom_path, &display.ines_size);
+    size_t ines_size = display.ines_size;
+    if (ines_data == NULL)
         goto no_cartridge;
 
-    // Read from the cartridge file into memory.
-    fseek(ines, 0, SEEK_END);
-    ines_size = ftell(ines);
-    ines_data = safe_malloc(ines_size);
-    fseek(ines, 0, SEEK_SET);
-    fread(ines_data, ines_size, 1, ines);
-    fclose(ines);
+    // Set up the NES computer.
+    display.computer = nes_alloc();
+    if ((display.cartridge = cartridge_alloc(ines_data, ines_size)) == NULL)
+    {
+        fprintf(stderr, "iNES ROM file is corrupt: %s\n", cartridge_error_msg());
+        exit(EXIT_FAILURE);
+    }
+    nes_setcartridge(display.computer, display.cartridge);
+
+    // Load the movie to play back, if any. Its seed replaces the time seed, so that
+    // the run is reproducible.
+    uint32_t rom_crc32 = crc32(0, ines_data, ines_size);
+    uint32_t seed = (uint32_t)time(NULL);
+    if (options.play_path)
+    {
+        if ((display.playback = movie_load(options.play_path)) == NULL)
+        {
+            fprintf(stderr, "movie is corrupt: %s\n", movie_error_msg());
+            exit(EXIT_FAILURE);
+        }
+        if (display.playback->rom_crc32 != rom_crc32)
+            fprintf(stderr, "movie: recorded on a different ROM (CRC-32 %08X, expected %08X)\n",
+                display.playback->rom_crc32, rom_crc32);
+        seed = display.playback->seed;
+    }
+    if (options.record_path)
+        display.recording = movie_alloc(rom_crc32, seed);
+    srand(seed);
+    nes_reset(display.computer);
+    profile_init(options.profile_interval, messages);
+    atexit(process_exit);
+
+    // Exports stop here.
+    if (options.export_path)
+        return run_export() ? EXIT_SUCCESS : EXIT_FAILURE;
+
+    // Trace the CPU, if asked to.
+    if (options.trace_path)
+    {
+        display.trace = trace_alloc(options.trace_records);
+        nes_settrace(display.computer, display.trace);
+    }
+
+    // Profile the game code, if asked to.
+#ifdef NES_PROFILE
+    if (options.cpu_profile_path || options.callgrind_path)
+    {
+        display.cpu_profile = cpu_profile_alloc();
+        nes_setprofile(display.computer, display.cpu_profile);
+    }
+#endif
+
+    // Set up the keyframes used for seeking through the movie, reusing the ones in
+    // the sidecar file if there are any.
+    if (display.playback)
+    {
+        uint32_t movie_crc = movie_crc32(display.playback);
+        if (options.keyframes_path && (display.keyframes = keyframes_load(options.keyframes_path)) 
+            && (display.keyframes->rom_crc32 != rom_crc32 || display.keyframes->movie_crc32 != movie_crc))
+        {
+            fprintf(stderr, "keyframes: %s belongs to a different %s; ignoring\n", options.keyframes_path,
+                display.keyframes->rom_crc32 != rom_crc32 ? "ROM" : "movie");
+            keyframes_free(display.keyframes);
+            display.keyframes = NULL;
+        }
+        if (display.keyframes == NULL)
+            display.keyframes = keyframes_alloc(rom_crc32, movie_crc, options.keyframe_interval);
+        keyframes_capture(display.keyframes, display.computer, 0);
+    }
+    if (options.seek && display.playback)
+    {
+        uint64_t start = get_ns_timestamp();
+        seek_frame(options.seek);
+        fprintf(messages, "seek: reached frame %u in %.1fms\n", display.frame, 
+            (double)(get_ns_timestamp() - start) / 1000000);
+    }
+
+    // Explorations stop here.
+    if (options.explore)
+        return run_explore() ? EXIT_SUCCESS : EXIT_FAILURE;
+
+    // Start dumping the audio/video output, if asked to.
+    if (options.dump_video_path || options.dump_audio_path)
+    {
+        if ((display.dump = dump_alloc(options.dump_video_path, options.dump_audio_path, AUDIO_FREQUENCY)) == NULL)
+        {
+            fprintf(stderr, "dump: %s\n", dump_error_msg());
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Start streaming frames, if asked to.
+    if (options.stream_name)
+    {
+        if ((display.stream = stream_alloc(options.stream_name, STREAM_SLOTS)) == NULL)
+        {
+            fprintf(stderr, "stream: %s\n", stream_error_msg());
+            exit(EXIT_FAILURE);
+        }
+        fprintf(messages, "stream: streaming frames to shared memory %s\n", display.stream->name);
+    }
+
+    // Start logging frames, if asked to. The PPU writes the palette indices straight
+    // into the frame log writer.
+    if (options.framelog_path)
+    {
+        if ((display.framelog = framelog_writer_alloc(options.framelog_path, rom_crc32)) == NULL)
+        {
+            fprintf(stderr, "framelog: %s\n", framelog_error_msg());
+            exit(EXIT_FAILURE);
+        }
+        nes_setindices(display.computer, display.framelog->current.pixels);
+    }
+
+    // Write observations, if asked to. They share the frame log's palette indices
+    // while it runs.
+    if (options.observe_path)
+    {
+        if ((display.observe = observe_alloc(OBSERVE_GREY, NULL, OBSERVE_W, OBSERVE_H)) == NULL)
+        {
+            fprintf(stderr, "observe: %s\n", observe_error_msg());
+            exit(EXIT_FAILURE);
+        }
+        if ((display.observe_file = fopen(options.observe_path, "wb")) == NULL)
+        {
+            fprintf(stderr, "observe: could not open %s\n", options.observe_path);
+            exit(EXIT_FAILURE);
+        }
+        display.observe_indices = safe_malloc(NES_W * NES_H);
+        if (display.framelog == NULL)
+            nes_setindices(display.computer, display.observe_indices);
+    }
+
+    // Report the memory taken up by the machine.
+    if (options.memory_report)
+    {
+        struct nes_memory memory;
+        nes_memory_report(display.computer, &memory);
+        fprintf(messages, "memory: %zu bytes per machine; cartridge %zu bytes (%zu mapped from the ROM), "
+            "%u reference(s)\n", memory.machine, memory.cartridge, memory.cartridge_mapped, memory.cartridge_refs);
+    }
+
+    // Batches stop here.
+    if (options.batch)
+    {
+        run_batch();
+        return EXIT_SUCCESS;
+    }
+
+    // Headless runs stop here. The PPU only needs a screen buffer if the pixels are
+    // being dumped.
+    if (options.headless)
+    {
+        if (display.dump)
+        {
+            display.screen = safe_calloc(NES_W * NES_H, sizeof(struct agbr8888));
+            nes_setscreen(display.computer, display.screen, NES_W * sizeof(struct agbr8888));
+        }
+        run_headless();
+        return EXIT_SUCCESS;
+    }
 
-    // Initialize SDL and the time seed.
+    // Initialize SDL.
     SDL_Init(SDL_INIT_EVERYTHING);
-    srand((unsigned)time(NULL));
 
     // Create the SDL window, renderer and the render texture.
     display.window = SDL_CreateWindow("nesemu", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
@@ -124,76 +1256,60 @@ int main(int argc, char** argv)
     display.renderer = SDL_CreateRenderer(display.window, -1, SDL_RENDERER_ACCELERATED);
     if (display.renderer == NULL)
         sdl_error();
-    display.buffer = SDL_CreateTexture(display.renderer, SDL_PIXELFORMAT_ABGR8888, SDL_TEXTUREACCESS_STREAMING,
-        NES_W, NES_H);
-    if (display.buffer == NULL)
-        sdl_error();
+    for (int i = 0; i < 3; ++i)
+    {
+        display.targets[i].texture = SDL_CreateTexture(display.renderer, SDL_PIXELFORMAT_ABGR8888, 
+            SDL_TEXTUREACCESS_STREAMING, NES_W, NES_H);
+        if (display.targets[i].texture == NULL)
+            sdl_error();
+    }
     SDL_SetWindowMinimumSize(display.window, NES_W, NES_H);
 
     // Set the display width/height to the default NES emulator's resolution.
     display.w = NES_W;
     display.h = NES_H;
 
+    // Create the audio ring. It holds a few device buffers' worth of samples, so
+    // that the emulation side has some slack before the callback runs dry.
+    display.audio_ring = audio_ring_alloc(options.audio_samples * AUDIO_RING_BUFFERS);
+
     // Configure the audio specification.
     SDL_AudioSpec spec;
     memset(&spec, 0, sizeof(spec));
-    spec.freq = 44100;              // 44.1KHz
+    spec.freq = AUDIO_FREQUENCY;
     spec.format = AUDIO_S16SYS;     // -32768 to 32767 sample values
     spec.channels = 1;              // Mono; the NES only outputted mono audio
-    spec.samples = 4096;            // 4096-sample buffer
-    spec.callback = NULL;
+    spec.samples = options.audio_samples;
+    spec.callback = audio_ring_callback;
+    spec.userdata = display.audio_ring;
 
     // Initialize the audio device.
     display.audio = SDL_OpenAudioDevice(NULL, 0, &spec, NULL, 0);
     if (display.audio == 0)
         sdl_error();
     SDL_PauseAudioDevice(display.audio, 0);
+    display.audio_active = true;
 
-    // Set up the NES computer.
-    display.computer = nes_alloc();
-    if ((display.cartridge = cartridge_alloc(ines_data, ines_size)) == NULL)
-    {
-        fprintf(stderr, "iNES ROM file is corrupt: %s\n", cartridge_error_msg());
-        exit(EXIT_FAILURE);
-    }
-    nes_setcartridge(display.computer, display.cartridge);
-    nes_reset(display.computer);
+    // Start the emulation thread.
+    triple_buffer_init(&display.frames, &display.targets[0], &display.targets[1], &display.targets[2]);
+    lock_target(triple_buffer_back(&display.frames));
+    lock_target(&display.targets[display.frames.middle]);
+    if ((display.frame_event = SDL_RegisterEvents(1)) == (Uint32)-1)
+        sdl_error();
+    display.running = true;
+    set_speed(options.turbo ? options.turbo_speed : SPEED_NORMAL);
+    if ((display.thread = SDL_CreateThread(emulate, "emulation", NULL)) == NULL)
+        sdl_error();
 
-    // Start the main event loop.
-    SDL_AddEventWatch(watcher, NULL);
-    atexit(process_exit);
-    uint64_t timestamp = 0;
-    float cached_framerate = 0.f;
-    bool first_frame_rendered = false;
+    // Start the main event loop. This thread only presents frames and polls events.
+    uint32_t input = 0, framerate = 0;
     for (;;)
     {
-        // Busywait until the time length of a PPU frame has been complete.
-        static float ns_per_ppu_cycle = (float)NANOSECOND / ((float)MASTER_CLOCK / 4);
-        uint64_t time_wait = display.computer->ppu->frame_cycles_enumerated * ns_per_ppu_cycle;
-        uint64_t new_timestamp = get_ns_timestamp();
-        while (display.computer->ppu->frame_complete 
-            && (new_timestamp = get_ns_timestamp()) - timestamp < time_wait)
-            continue;
-
-        // Calculate the framerate and change the window title.
-        if (first_frame_rendered)
-        {
-            cached_framerate = lerp(cached_framerate, 
-                1 / ((float)(new_timestamp - timestamp) / NANOSECOND), 
-                min(max(1 / cached_framerate * 2, 0), 1));
-            char buffer[64];
-            snprintf(buffer, sizeof(buffer), "nesemu: %dfps", (int)cached_framerate);
-            SDL_SetWindowTitle(display.window, buffer);
-        }
-
-        // Reset the PPU.
-        timestamp = new_timestamp;
-        display.computer->ppu->frame_complete = false;
-        display.computer->ppu->frame_cycles_enumerated = 0;
-
-        // Poll each event.
+        // Block until something happens.
         SDL_Event event;
-        while (SDL_PollEvent(&event))
+        if (!SDL_WaitEvent(&event))
+            sdl_error();
+        do
         {
             switch (event.type)
             {
@@ -201,114 +1317,60 @@ int main(int argc, char** argv)
             case SDL_QUIT:
                 goto quit;
 
-            // Set a controller input.
+            // Set/release a controller input. The emulation thread latches the
+            // snapshot at the start of each frame.
             case SDL_KEYDOWN:
-                switch ((int)event.key.keysym.scancode)
-                {
-                // A key.
-                case SDL_SCANCODE_X:
-                    display.computer->controllers[0].vars.a = 1;
-                    break;
-
-                // B key.
-                case SDL_SCANCODE_Z:
-                    display.computer->controllers[0].vars.b = 1;
-                    break;
-
-                // Select key.
-                case SDL_SCANCODE_A:
-                    display.computer->controllers[0].vars.select = 1;
-                    break;
-
-                // Start key.
-                case SDL_SCANCODE_S:
-                    display.computer->controllers[0].vars.start = 1;
-                    break;
-                
-                // Up arrow key.
-                case SDL_SCANCODE_UP:
-                    display.computer->controllers[0].vars.up = 1;
-                    break;
-
-                // Down arrow key.
-                case SDL_SCANCODE_DOWN:
-                    display.computer->controllers[0].vars.down = 1;
+                if (!event.key.repeat && hotkey(event.key.keysym.scancode))
                     break;
-
-                // Left arrow key.
-                case SDL_SCANCODE_LEFT:
-                    display.computer->controllers[0].vars.left = 1;
-                    break;
-
-                // Right arrow key.
-                case SDL_SCANCODE_RIGHT:
-                    display.computer->controllers[0].vars.right = 1;
-                    break;
-                }
+                input |= key_input(event.key.keysym.scancode);
+                atomic_store_u32(&display.input, input);
                 break;
-
-            // Release a controller input.
             case SDL_KEYUP:
-                switch ((int)event.key.keysym.scancode)
-                {
-                // A key.
-                case SDL_SCANCODE_X:
-                    display.computer->controllers[0].vars.a = 0;
-                    break;
-
-                // B key.
-                case SDL_SCANCODE_Z:
-                    display.computer->controllers[0].vars.b = 0;
-                    break;
-
-                // Select key.
-                case SDL_SCANCODE_A:
-                    display.computer->controllers[0].vars.select = 0;
-                    break;
-
-                // Start key.
-                case SDL_SCANCODE_S:
-                    display.computer->controllers[0].vars.start = 0;
-                    break;
-                
-                // Up arrow key.
-                case SDL_SCANCODE_UP:
-                    display.computer->controllers[0].vars.up = 0;
-                    break;
-
-                // Down arrow key.
-                case SDL_SCANCODE_DOWN:
-                    display.computer->controllers[0].vars.down = 0;
-                    break;
-
-                // Left arrow key.
-                case SDL_SCANCODE_LEFT:
-                    display.computer->controllers[0].vars.left = 0;
-                    break;
+                input &= ~key_input(event.key.keysym.scancode);
+                atomic_store_u32(&display.input, input);
+                break;
 
-                // Right arrow key.
-                case SDL_SCANCODE_RIGHT:
-                    display.computer->controllers[0].vars.right = 0;
-                    break;
+            // The window has been resized - re-scale the display and re-draw it.
+            case SDL_WINDOWEVENT:
+                if (event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED)
+                {
+                    float scale = min((float)event.window.data1 / NES_W, (float)event.window.data2 / NES_H);
+                    display.w = NES_W * scale;
+                    display.h = NES_H * scale;
+                    update_render();
                 }
                 break;
+
+            // A new frame has been published; upload and present it.
+            default:
+                if (event.type == display.frame_event)
+                    present_frame();
+                break;
             }
-        }
+        } while (SDL_PollEvent(&event));
 
-        // Clock the NES enough times to render a whole frame.
-        while (!display.computer->ppu->frame_complete)
-            nes_clock(display.computer);
-        
-        // Update the buffer and re-render it.
-        first_frame_rendered = true;
-        SDL_UpdateTexture(display.buffer, NULL, &display.computer->ppu->screen, 
-            NES_W * sizeof(struct agbr8888));
-        update_render();
+        // Update the window title if the framerate has changed.
+        uint32_t new_framerate = atomic_load_u32(&display.framerate);
+        if (new_framerate != framerate)
+        {
+            char buffer[64];
+            snprintf(buffer, sizeof(buffer), "nesemu: %ufps", (framerate = new_framerate));
+            SDL_SetWindowTitle(display.window, buffer);
+        }
     }
 
     // Exit.
 no_cartridge:
-    puts("usage: nesemu game.nes");
+    puts("usage: nesemu [--audio-buffer samples] [--speed 2|4|8|0] [--frameskip n] [--turbo]\n"
+         "              [--record movie.nmv] [--play movie.nmv] [--headless] [--frames n]\n"
+         "              [--keyframes file] [--keyframe-interval n] [--seek frame]\n"
+         "              [--export video.raw] [--jobs n] [--dump-video video.y4m|-]\n"
+         "              [--dump-audio audio.wav|-] [--framelog frames.nfl] [--observe obs.raw]\n"
+         "              [--profile-interval n] [--cpu-profile report.txt] [--callgrind callgrind.out]\n"
+         "              [--trace trace.ntr] [--trace-records n] [--memory-report]\n"
+         "              [--explore n] [--explore-score addr] [--explore-goal n] [--explore-prune]\n"
+         "              [--batch n] [--stream name]\n"
+         "              game.nes");
 quit:
     return EXIT_SUCCESS;
 }
\ No newline at end of file
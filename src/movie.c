@@ -0,0 +1,175 @@
+/*
+; Input movies: a deterministic recording of the controller input of every frame,
+; along with enough information to replay it from power-on.
+;
+; The file format is a small little-endian header followed by two bytes of input
+; per frame (controller port 0, then port 1, in the union controller layout). 
+*/
+
+#include <stdio.h>
+#include <memory.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "util.h"
+#include "movie.h"
+
+#define MOVIE_MAGIC     0x1A564D4E  // "NMV\x1A"
+#define MOVIE_VERSION   1
+
+// Internal error message buffer.
+static char error_msg[128];
+
+// Movie file format header.
+struct movie_header
+{
+    int32_t magic;              // "NMV\x1A"; see MOVIE_MAGIC macro
+    uint16_t version;           // see MOVIE_VERSION macro
+    uint16_t ports;             // number of controller ports stored per frame (always 2)
+    uint32_t rom_crc32;         // CRC-32 of the iNES file
+    uint32_t seed;              // power-on seed
+    uint32_t frame_count;       // number of frames of input that follow
+};
+
+// Append a frame of input to the movie.
+void movie_record(struct movie* movie, const union controller controllers[2])
+{
+    // Grow the input buffer if necessary.
+    if (movie->frame_count == movie->frame_capacity)
+    {
+        movie->frame_capacity = movie->frame_capacity ? movie->frame_capacity * 2 : 1024;
+        uint8_t* inputs = safe_calloc(movie->frame_capacity, 2);
+        memcpy(inputs, movie->inputs, movie->frame_count * 2);
+        free(movie->inputs);
+        movie->inputs = inputs;
+    }
+
+    // Store the input.
+    movie->inputs[movie->frame_count * 2 + 0] = controllers[0].value;
+    movie->inputs[movie->frame_count * 2 + 1] = controllers[1].value;
+    movie->frame_count++;
+}
+
+// Drop every frame of input from the given frame onwards.
+void movie_truncate(struct movie* movie, uint32_t frame_count)
+{
+    movie->frame_count = min(movie->frame_count, frame_count);
+}
+
+// Fetch the input for the given frame.
+bool movie_input(struct movie* movie, uint32_t frame, union controller controllers[2])
+{
+    if (frame >= movie->frame_count)
+        return false;
+    controllers[0].value = movie->inputs[frame * 2 + 0];
+    controllers[1].value = movie->inputs[frame * 2 + 1];
+    return true;
+}
+
+// Get the CRC-32 of the movie's seed and input.
+uint32_t movie_crc32(struct movie* movie)
+{
+    uint32_t crc = crc32(0, &movie->seed, sizeof(movie->seed));
+    return crc32(crc, movie->inputs, (size_t)movie->frame_count * 2);
+}
+
+// Save the movie to a file.
+bool movie_save(struct movie* movie, const char* path)
+{
+    FILE* file = fopen(path, "wb");
+    if (file == NULL)
+        return false;
+    struct movie_header header = 
+    {
+        .magic = MOVIE_MAGIC,
+        .version = MOVIE_VERSION,
+        .ports = 2,
+        .rom_crc32 = movie->rom_crc32,
+        .seed = movie->seed,
+        .frame_count = movie->frame_count
+    };
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1
+        && fwrite(movie->inputs, 2, movie->frame_count, file) == movie->frame_count;
+    return (fclose(file) == 0) && written;
+}
+
+// Load a movie from a file.
+struct movie* movie_load(const char* path)
+{
+    // Read the header.
+    FILE* file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        snprintf(error_msg, sizeof(error_msg), "could not open %s", path);
+        return NULL;
+    }
+    struct movie_header header;
+    if (fread(&header, sizeof(header), 1, file) != 1)
+    {
+        snprintf(error_msg, sizeof(error_msg), "movie header size too small");
+        goto corrupt_header;
+    }
+
+    // Validate the header.
+    if (header.magic != MOVIE_MAGIC)
+    {
+        snprintf(error_msg, sizeof(error_msg), "incorrect magic");
+        goto corrupt_header;
+    }
+    if (header.version != MOVIE_VERSION)
+    {
+        snprintf(error_msg, sizeof(error_msg), "movie version %u is not supported", header.version);
+        goto corrupt_header;
+    }
+    if (header.ports != 2)
+    {
+        snprintf(error_msg, sizeof(error_msg), "movies of %u controller port(s) are not supported", header.ports);
+        goto corrupt_header;
+    }
+
+    // Read the input.
+    struct movie* movie = movie_alloc(header.rom_crc32, header.seed);
+    if (header.frame_count)
+    {
+        movie->inputs = safe_calloc(header.frame_count, 2);
+        movie->frame_capacity = header.frame_count;
+        movie->frame_count = (uint32_t)fread(movie->inputs, 2, header.frame_count, file);
+        if (movie->frame_count != header.frame_count)
+        {
+            snprintf(error_msg, sizeof(error_msg), "expected %u frames, got %u", 
+                header.frame_count, movie->frame_count);
+            movie_free(movie);
+            goto corrupt_header;
+        }
+    }
+    fclose(file);
+    return movie;
+
+corrupt_header:
+    fclose(file);
+    return NULL;
+}
+
+// Create a new, empty movie instance.
+struct movie* movie_alloc(uint32_t rom_crc32, uint32_t seed)
+{
+    struct movie* movie = safe_malloc(sizeof(struct movie));
+    movie->rom_crc32 = rom_crc32;
+    movie->seed = seed;
+    return movie;
+}
+
+// Free a movie instance.
+void movie_free(struct movie* movie)
+{
+    if (movie == NULL)
+        return;
+    free(movie->inputs);
+    free(movie);
+}
+
+// Get the movie error message.
+const char* movie_error_msg()
+{
+    return error_msg;
+}
\ No newline at end of file
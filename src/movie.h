@@ -0,0 +1,52 @@
+/*
+; Input movies: a deterministic recording of the controller input of every frame,
+; along with enough information to replay it from power-on.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "nes.h"
+
+// Movie struct definition.
+struct movie
+{
+    // Power-on information.
+    uint32_t rom_crc32;         // CRC-32 of the iNES file the movie was recorded on.
+    uint32_t seed;              // Seed used for anything randomized at power-on.
+
+    // Per-frame input; two bytes (controller ports 0 and 1) per frame.
+    uint8_t* inputs;
+    uint32_t frame_count;
+    uint32_t frame_capacity;
+};
+
+// Append a frame of input to the movie.
+void movie_record(struct movie* movie, const union controller controllers[2]);
+
+// Drop every frame of input from the given frame onwards.
+void movie_truncate(struct movie* movie, uint32_t frame_count);
+
+// Fetch the input for the given frame. Returns false if the frame is past the end
+// of the movie.
+bool movie_input(struct movie* movie, uint32_t frame, union controller controllers[2]);
+
+// Get the CRC-32 of the movie's seed and input, which identifies the run it plays back.
+uint32_t movie_crc32(struct movie* movie);
+
+// Save the movie to a file. Returns false on failure.
+bool movie_save(struct movie* movie, const char* path);
+
+// Load a movie from a file. Returns NULL on failure; see movie_error_msg().
+struct movie* movie_load(const char* path);
+
+// Create a new, empty movie instance.
+struct movie* movie_alloc(uint32_t rom_crc32, uint32_t seed);
+
+// Free a movie instance.
+void movie_free(struct movie* movie);
+
+// Get the movie error message.
+const char* movie_error_msg();
\ No newline at end of file
@@ -2,22 +2,27 @@
 ; The NES computer struct definition, with the appropriate emulated hardware.
 */
 
+#include <memory.h>
+
 #include "util.h"
 #include "nes.h"
 #include "cpu.h"
 #include "ppu.h"
 #include "cartridge.h"
+#include "profile.h"
 
 // Reset the NES.
 void nes_reset(struct nes* computer)
 {
     computer->cycles = 0;
+    computer->frame_count = 0;
     computer->oam_cycle_count = 0;
     computer->oam_page = 0;
     computer->oam_offset = 0;
     computer->oam_executing_dma = false;
-    cpu_reset(computer->cpu);
-    ppu_reset(computer->ppu);
+    cpu_reset(&computer->cpu);
+    ppu_reset(&computer->ppu);
+    computer->hash_dirty = NES_HASH_ALL_PAGES;
 }
 
 // Read a byte from a given address.
@@ -34,7 +39,7 @@ uint8_t nes_read(struct nes* computer, uint16_t address)
 
     // $2000-$3FFF: NES PPU registers.
     else if (0x2000 <= address && address <= 0x3FFF)
-        return ppu_cpu_read(computer->ppu, address & 0x0007);
+        return ppu_cpu_read(&computer->ppu, address & 0x0007);
 
     // $4016-$4017: controller input.
     // The returned byte is supposed to have input data lines D0-D4, however
@@ -52,6 +57,17 @@ uint8_t nes_read(struct nes* computer, uint16_t address)
     return 0;
 }
 
+// Read a byte from a given address without any side effects.
+uint8_t nes_peek(struct nes* computer, uint16_t address)
+{
+    uint8_t byte;
+    if (cartridge_cpu_read(computer->cartridge, address, &byte))
+        return byte;
+    else if (address <= 0x1FFF)
+        return computer->ram[address & 0x7FF];
+    return 0;
+}
+
 // Write a byte to a given address.
 void nes_write(struct nes* computer, uint16_t address, uint8_t byte)
 {
@@ -61,11 +77,14 @@ void nes_write(struct nes* computer, uint16_t address, uint8_t byte)
 
     // $0000-$1FFF: internal RAM.
     else if (0x0000 <= address && address <= 0x1FFF)
+    {
         computer->ram[address & 0x7FF] = byte;
+        nes_hash_dirty(computer, NES_HASH_PAGE_RAM + (address & 0x7FF) / NES_HASH_PAGE_SIZE);
+    }
 
     // $2000-$3FFF: NES PPU registers.
     else if (0x2000 <= address && address <= 0x3FFF)
-        ppu_cpu_write(computer->ppu, address & 0x0007, byte);
+        ppu_cpu_write(&computer->ppu, address & 0x0007, byte);
 
     // $4014: NES OAM direct memory access.
     else if (address == 0x4014)
@@ -73,7 +92,7 @@ void nes_write(struct nes* computer, uint16_t address, uint8_t byte)
         computer->oam_page = byte;
         computer->oam_offset = 0x00;
         computer->oam_executing_dma = true;
-        computer->idle_cycle = computer->cpu->enumerated_cycles & 1;
+        computer->idle_cycle = computer->cpu.enumerated_cycles & 1;
     }
 
     // $4016: set the controller port latch bit (the expansion port is not emulated).
@@ -84,6 +103,7 @@ void nes_write(struct nes* computer, uint16_t address, uint8_t byte)
         {
             computer->controller_cache[0] = computer->controllers[0].value;
             computer->controller_cache[1] = computer->controllers[1].value;
+            computer->input_latched = true;
         }
     }
 
@@ -95,7 +115,7 @@ void nes_clock(struct nes* computer)
 {
     // For every 4th cycle, clock the PPU.
     if (computer->cycles % 4 == 0)
-        ppu_clock(computer->ppu);
+        ppu_clock(&computer->ppu);
 
     // For every 12th cycle, clock the CPU.
     if (computer->cycles % 12 == 0)
@@ -103,12 +123,14 @@ void nes_clock(struct nes* computer)
         // Override CPU clocking with OAM DMA if it is currently taking place.
         if (computer->oam_executing_dma)
         {
+            PROFILE_BEGIN(dma_start);
             // For each odd non-idle cycle (read/write cycles are combined for ease
             // of emulation), copy from the given CPU page:offset to OAM.
             if (computer->oam_cycle_count <= 512 && computer->oam_cycle_count & 1)
             {
                 uint8_t byte = nes_read(computer, (computer->oam_page << 8) | computer->oam_offset);
-                computer->ppu->oam_byte_pointer[computer->oam_offset++] = byte;
+                ppu_oam_bytes(&computer->ppu)[computer->oam_offset++] = byte;
+                nes_hash_dirty(computer, NES_HASH_PAGE_OAM);
             }
 
             // Handle the number of executed CPU cycles. This procedure takes 513 cycles,
@@ -124,18 +146,19 @@ void nes_clock(struct nes* computer)
                     computer->oam_executing_dma = false;
                 }
             }
+            PROFILE_END(dma_start, PROFILE_DMA);
         }
         else
         {
-            //if (computer->cpu->cycles == 0)
-            //    cpu_spew(computer->cpu, computer->cpu->pc, stdout);
-            cpu_clock(computer->cpu);
+            PROFILE_BEGIN(cpu_start);
+            cpu_clock(&computer->cpu);
+            PROFILE_END(cpu_start, PROFILE_CPU);
         }
     }
     
     // Change the CPU NMI status depending on the PPU's vblank flag status.
-    computer->cpu->nmi = !(computer->ppu->ppustatus.vars.vblank_flag && 
-        computer->ppu->ppuctrl.vars.vblank_nmi_enable);
+    computer->cpu.nmi = !(computer->ppu.ppustatus.vars.vblank_flag && 
+        computer->ppu.ppuctrl.vars.vblank_nmi_enable);
 
     // Increment the total number of cycles.
     computer->cycles++; 
@@ -143,21 +166,189 @@ void nes_clock(struct nes* computer)
         computer->cycles = 0;
 }
 
-// Create a new NES computer instance.
-struct nes* nes_alloc()
+// Emulate a single frame.
+void nes_frame(struct nes* computer)
 {
-    // Allocate a new NES computer instance.
-    struct nes* computer = safe_malloc(sizeof(struct nes));
+    // Reset the PPU's frame status, then clock until the frame is complete.
+    computer->ppu.frame_complete = false;
+    computer->ppu.frame_cycles_enumerated = 0;
+    while (!computer->ppu.frame_complete)
+        nes_clock(computer);
+    computer->frame_count++;
+}
+
+// Emulate a number of frames.
+uint64_t nes_run_frames(struct nes* computer, const uint8_t* inputs, uint32_t count, uint32_t flags)
+{
+    bool render_skip = computer->render_skip;
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        if (inputs)
+        {
+            computer->controllers[0].value = inputs[i * 2 + 0];
+            computer->controllers[1].value = inputs[i * 2 + 1];
+        }
+        computer->render_skip = render_skip || (flags & NES_RUN_NO_VIDEO)
+            || ((flags & NES_RUN_LAST_VIDEO) && i + 1 < count);
+        nes_frame(computer);
+    }
+    computer->render_skip = render_skip;
+    return computer->frame_count;
+}
+
+// Get a page of hashed memory, and its size.
+static const uint8_t* hash_page(struct nes* computer, unsigned page, size_t* size)
+{
+    *size = NES_HASH_PAGE_SIZE;
+    if (page < NES_HASH_PAGE_VRAM)
+        return computer->ram + (page - NES_HASH_PAGE_RAM) * NES_HASH_PAGE_SIZE;
+    else if (page < NES_HASH_PAGE_OAM)
+        return computer->ppu.vram + (page - NES_HASH_PAGE_VRAM) * NES_HASH_PAGE_SIZE;
+    else if (page == NES_HASH_PAGE_OAM)
+        return ppu_oam_bytes(&computer->ppu);
+    *size = sizeof(computer->ppu.palette_ram);
+    return computer->ppu.palette_ram;
+}
+
+// Hash the state of the NES.
+uint64_t nes_hash(struct nes* computer)
+{
+    // Hash the pages written to since the last hash.
+    for (unsigned page = 0; page < NES_HASH_PAGES; ++page)
+    {
+        if (computer->hash_dirty & (1u << page))
+        {
+            size_t size;
+            const uint8_t* data = hash_page(computer, page, &size);
+            computer->page_hashes[page] = hash64(page, data, size);
+        }
+    }
+    computer->hash_dirty = 0;
+
+    // Gather up the registers. The CPU may be part way through an instruction, and the
+    // CPU and PPU part way through a clock cycle, so that is part of the state too. So
+    // is the parity of the CPU cycle count, which decides when OAM DMA starts.
+    struct cpu* cpu = &computer->cpu;
+    uint8_t registers[] =
+    {
+        cpu->a, cpu->x, cpu->y, cpu->p, cpu->s, cpu->pc & 0xFF, cpu->pc >> 8,
+        cpu->opcode, cpu->cycles, cpu->addr_fetched & 0xFF, cpu->addr_fetched >> 8,
+        cpu->nmi, cpu->irq, cpu->irq_toggle, cpu->nmi_toggle, cpu->enumerated_cycles & 1,
+        computer->controller_port_latch, computer->controller_cache[0], computer->controller_cache[1],
+        computer->oam_executing_dma, computer->idle_cycle, computer->oam_page, computer->oam_offset,
+        computer->oam_cycle_count & 0xFF, computer->oam_cycle_count >> 8, computer->cycles % 12
+    };
+
+    // The PPU is part way through a frame too, with the tiles and sprites of the
+    // scanline it is drawing fetched into its latches and shifters. Everything after
+    // its memory is hashed as it lies, up to the debug cycle count.
+    const uint8_t* ppu = (const uint8_t*)&computer->ppu;
+    size_t ppu_start = offsetof(struct ppu, oam_secondary);
+    size_t ppu_end = offsetof(struct ppu, frame_complete) + sizeof(computer->ppu.frame_complete);
+
+    // Hash the page hashes, the registers and the PPU together.
+    uint64_t hash = hash64(0, computer->page_hashes, sizeof(computer->page_hashes));
+    hash = hash64(hash, registers, sizeof(registers));
+    return hash64(hash, ppu + ppu_start, ppu_end - ppu_start);
+}
 
-    // Create the NES computer's CPU.
-    computer->cpu = cpu_alloc();
-    cpu_setnes(computer->cpu, computer);
+// Return the size of a save state, in bytes.
+size_t nes_state_size()
+{
+    return NES_STATE_SIZE;
+}
+
+// Save the state of the NES into a buffer.
+void nes_state_save(struct nes* computer, void* state)
+{
+    memcpy(state, computer, NES_STATE_SIZE);
+}
+
+// Restore the state of the NES from a buffer.
+void nes_state_load(struct nes* computer, const void* state)
+{
+    memcpy(computer, state, NES_STATE_SIZE);
+    computer->hash_dirty = NES_HASH_ALL_PAGES;
+}
+
+// The reference that hibernated states are coded against.
+static const uint8_t blank_state[NES_STATE_SIZE];
 
-    // Create the NES computer's PPU.
-    computer->ppu = ppu_alloc();
-    ppu_setnes(computer->ppu, computer);
+// Compress the state of the NES into a blob.
+uint8_t* nes_hibernate(struct nes* computer, size_t* size)
+{
+    uint8_t coded[RUN_CODED_MAX_SIZE(NES_STATE_SIZE)];
+    *size = run_encode((const uint8_t*)computer, blank_state, NES_STATE_SIZE, coded);
+    uint8_t* blob = safe_malloc(*size);
+    memcpy(blob, coded, *size);
+    return blob;
+}
+
+// Restore the state of the NES from a blob.
+bool nes_wake(struct nes* computer, const uint8_t* blob, size_t size)
+{
+    uint8_t state[NES_STATE_SIZE];
+    if (run_decode(blob, size, blank_state, NES_STATE_SIZE, state) != size)
+        return false;
+    nes_state_load(computer, state);
+    return true;
+}
+
+// Copy the machine state of one NES into another.
+void nes_clone(struct nes* dst, struct nes* src)
+{
+    if (dst->cartridge != src->cartridge)
+        nes_setcartridge(dst, src->cartridge);
+    memcpy(dst, src, NES_STATE_SIZE);
+
+    // The source's page hashes hold for the copy too.
+    dst->hash_dirty = src->hash_dirty;
+    memcpy(dst->page_hashes, src->page_hashes, sizeof(dst->page_hashes));
+}
 
-    // Return the NES computer.
+// Set the cartridge of the NES.
+void nes_setcartridge(struct nes* computer, struct cartridge* cartridge)
+{
+    cartridge_retain(cartridge);
+    cartridge_free(computer->cartridge);
+    computer->cartridge = cartridge;
+}
+
+// Report the memory used by the NES.
+void nes_memory_report(struct nes* computer, struct nes_memory* memory)
+{
+    memset(memory, 0, sizeof(struct nes_memory));
+    memory->machine = sizeof(struct nes);
+    struct cartridge* cartridge = computer->cartridge;
+    if (cartridge)
+    {
+        memory->cartridge_mapped = cartridge->prg_rom_size + cartridge->chr_rom_size;
+        memory->cartridge = sizeof(struct cartridge) + sizeof(struct mapper) + cartridge->prg_rom_size 
+            + cartridge->chr_rom_size;
+        memory->cartridge_refs = atomic_load_u32(&cartridge->refs);
+    }
+}
+
+// Initialize a NES computer instance in caller-provided memory.
+void nes_init(struct nes* computer)
+{
+    memset(computer, 0, sizeof(struct nes));
+    cpu_init(&computer->cpu);
+    ppu_init(&computer->ppu);
+    computer->hash_dirty = NES_HASH_ALL_PAGES;
+}
+
+// Release a NES computer instance initialized with nes_init().
+void nes_release(struct nes* computer)
+{
+    nes_setcartridge(computer, NULL);
+}
+
+// Create a new NES computer instance on the heap.
+struct nes* nes_alloc()
+{
+    struct nes* computer = safe_malloc(sizeof(struct nes));
+    nes_init(computer);
     return computer;
 }
 
@@ -166,7 +357,6 @@ void nes_free(struct nes* computer)
 {
     if (computer == NULL)
         return;
-    ppu_free(computer->ppu);
-    cpu_free(computer->cpu);
+    nes_release(computer);
     free(computer);
 }
\ No newline at end of file
@@ -4,6 +4,7 @@
 
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 
@@ -13,6 +14,21 @@
 
 #define MASTER_CLOCK 21477272 // Hz
 
+// Pages of memory hashed separately by nes_hash(), so that only the pages written to
+// since the last hash need hashing again: internal RAM, then VRAM, then OAM and the
+// palette RAM.
+#define NES_HASH_PAGE_SIZE      0x100
+#define NES_HASH_PAGE_RAM       0
+#define NES_HASH_PAGE_VRAM      8
+#define NES_HASH_PAGE_OAM       16
+#define NES_HASH_PAGE_PALETTE   17
+#define NES_HASH_PAGES          18
+#define NES_HASH_ALL_PAGES      ((1u << NES_HASH_PAGES) - 1)
+
+// nes_run_frames() flags.
+#define NES_RUN_NO_VIDEO        0x01    // Skip rendering: only the machine state is wanted.
+#define NES_RUN_LAST_VIDEO      0x02    // Only render the last frame run (frame skipping).
+
 // Controller struct definition.
 union controller
 { 
@@ -30,13 +46,15 @@ union controller
     uint8_t value;
 };
 
-// NES computer struct definition.
+// NES computer struct definition. Everything up to the host bindings is the state of
+// the machine: plain data holding no pointers, so that a machine can be copied with a
+// single memcpy() and can live anywhere in memory (see nes_clone()).
 struct nes
 {
-    // Connected hardware.
-    struct cpu* cpu;
-    struct ppu* ppu;
-    struct cartridge* cartridge;
+    // Connected hardware. The CPU and PPU find the computer they are part of from
+    // their own address (see cpu_nes() and ppu_nes()).
+    struct cpu cpu;
+    struct ppu ppu;
     union controller controllers[2];    // Only standard NES controllers are currently emulated.
 
     // Standard controller cache.
@@ -48,6 +66,7 @@ struct nes
 
     // NES clock.
     uint64_t cycles;
+    uint64_t frame_count;               // Frames completed since the last reset.
 
     // OAM.
     bool oam_executing_dma;
@@ -55,28 +74,179 @@ struct nes
     uint8_t oam_page;
     uint8_t oam_offset;
     int16_t oam_cycle_count;
+
+    // Host bindings. These belong to the instance rather than the machine state, so
+    // they are neither saved nor copied between instances.
+    struct cartridge* cartridge;        // Shared, read-only; see nes_setcartridge().
+    struct agbr8888* screen;            // Buffer the PPU renders into (NULL: none).
+    size_t screen_pitch;
+    uint8_t* screen_indices;            // If set, each pixel's 6-bit palette index is also written here.
+    bool render_skip;                   // If set, no pixels are composed or written.
+    bool input_latched;                 // Set whenever the game latches the controllers; cleared by the caller.
+    struct trace* trace;                // Trace to record every instruction into (NULL: none).
+#ifdef NES_PROFILE
+    struct cpu_profile* profile;        // Game code profile to count into (NULL: none).
+#endif
+
+    // State hash cache: the hash of each page as of the last nes_hash(), and a bit for
+    // each page written to since.
+    uint32_t hash_dirty;
+    uint64_t page_hashes[NES_HASH_PAGES];
 };
 
-// Set the cartridge of the NES.
-inline void nes_setcartridge(struct nes* computer, struct cartridge* cartridge)
+// Size of the machine state at the start of struct nes.
+#define NES_STATE_SIZE      offsetof(struct nes, cartridge)
+
+// Get the NES computer that a CPU is part of.
+inline struct nes* cpu_nes(struct cpu* cpu)
+{
+    return (struct nes*)((uint8_t*)cpu - offsetof(struct nes, cpu));
+}
+
+// Get the NES computer that a PPU is part of.
+inline struct nes* ppu_nes(struct ppu* ppu)
+{
+    return (struct nes*)((uint8_t*)ppu - offsetof(struct nes, ppu));
+}
+
+// Mark a page of hashed memory as written to.
+inline void nes_hash_dirty(struct nes* computer, unsigned page)
+{
+    computer->hash_dirty |= 1u << page;
+}
+
+// Get the buffer the PPU renders into, as set by nes_setscreen() (NULL: none). It
+// holds the last frame rendered.
+inline const struct agbr8888* nes_screen(const struct nes* computer)
 {
-    computer->cartridge = cartridge;
+    return computer->screen;
 }
 
+// Get the internal RAM.
+inline const uint8_t* nes_ram(const struct nes* computer)
+{
+    return computer->ram;
+}
+
+// Get the number of frames completed since the last reset.
+inline uint64_t nes_frame_count(const struct nes* computer)
+{
+    return computer->frame_count;
+}
+
+// Memory used by a NES computer instance, in bytes.
+struct nes_memory
+{
+    size_t machine;                     // The NES computer, owned by the instance.
+    size_t cartridge;                   // The cartridge, shared between the instances using it.
+    size_t cartridge_mapped;            // The part of the cartridge mapped from the ROM file.
+    uint32_t cartridge_refs;            // Number of references to the cartridge.
+};
+
+// Set the cartridge of the NES, taking a reference to it and dropping the one to the
+// previous cartridge.
+void nes_setcartridge(struct nes* computer, struct cartridge* cartridge);
+
+// Set the buffer that the PPU renders into. The buffer must hold NES_H rows of NES_W
+// pixels, each row being pitch bytes apart. Passing NULL stops it.
+inline void nes_setscreen(struct nes* computer, void* pixels, size_t pitch)
+{
+    computer->screen = pixels;
+    computer->screen_pitch = pitch;
+}
+
+// Set a buffer of NES_H rows of NES_W bytes that the PPU writes each pixel's palette
+// index into, alongside the screen. Passing NULL stops it.
+inline void nes_setindices(struct nes* computer, uint8_t* indices)
+{
+    computer->screen_indices = indices;
+}
+
+// Attach a trace to the CPU, or detach it with NULL.
+inline void nes_settrace(struct nes* computer, struct trace* trace)
+{
+    computer->trace = trace;
+}
+
+#ifdef NES_PROFILE
+// Attach a game code profile to the CPU, or detach it with NULL.
+inline void nes_setprofile(struct nes* computer, struct cpu_profile* profile)
+{
+    computer->profile = profile;
+}
+#endif
+
+// Report the memory used by the NES. The screen buffer, if any, belongs to the caller,
+// and is not counted.
+void nes_memory_report(struct nes* computer, struct nes_memory* memory);
+
 // Reset the NES.
 void nes_reset(struct nes* computer);
 
 // Read a byte from a given address.
 uint8_t nes_read(struct nes* computer, uint16_t address);
 
+// Read a byte from a given address without any side effects, for debugging: only
+// internal RAM and the cartridge are read, and anything else reads as zero.
+uint8_t nes_peek(struct nes* computer, uint16_t address);
+
 // Write a byte to a given address.
 void nes_write(struct nes* computer, uint16_t address, uint8_t byte);
 
 // Clock the NES.
 void nes_clock(struct nes* computer);
 
-// Create a new NES computer instance.
+// Emulate a single frame: clock the NES until the PPU has completed a frame.
+void nes_frame(struct nes* computer);
+
+// Emulate a number of frames, returning at the end of the last one. inputs holds two
+// bytes (controller ports 0 and 1) per frame, laid out as in movies; if NULL, the
+// controllers are left as they are. flags is a combination of the NES_RUN_* flags,
+// which apply on top of render_skip. Returns the frame count after the last frame.
+uint64_t nes_run_frames(struct nes* computer, const uint8_t* inputs, uint32_t count, uint32_t flags);
+
+// Hash the state of the NES that decides what it does next: the CPU registers, the PPU
+// registers, latches and shifters, internal RAM, VRAM, OAM, palette RAM, and the
+// controller and DMA state. The clock counts are left out (bar their phase), so that
+// the same state reached at different times hashes the same. It may be taken at any
+// point, not just between frames. Only the pages written to since the last hash are
+// hashed again.
+uint64_t nes_hash(struct nes* computer);
+
+// Return the size of a save state, in bytes.
+size_t nes_state_size();
+
+// Save the state of the NES (CPU, PPU, internal RAM, controller and DMA state) into
+// a buffer of nes_state_size() bytes.
+void nes_state_save(struct nes* computer, void* state);
+
+// Restore the state of the NES from a buffer filled in by nes_state_save(). The host
+// bindings (the cartridge, output buffers, etc.) are left as they are.
+void nes_state_load(struct nes* computer, const void* state);
+
+// Compress the state of the NES into a newly allocated blob, storing its size. The
+// blob is a save state coded as runs (see run_encode()); machines mostly hold zeroes
+// and repeated bytes, so it usually takes a fraction of nes_state_size().
+uint8_t* nes_hibernate(struct nes* computer, size_t* size);
+
+// Restore the state of the NES from a blob made by nes_hibernate(). Returns false if
+// the blob is corrupt.
+bool nes_wake(struct nes* computer, const uint8_t* blob, size_t size);
+
+// Copy the machine state of one NES into another, which takes a reference to the
+// source's cartridge too. The destination keeps its other host bindings.
+void nes_clone(struct nes* dst, struct nes* src);
+
+// Initialize a NES computer instance in caller-provided memory, such as an array or
+// shared memory. It must be released with nes_release().
+void nes_init(struct nes* computer);
+
+// Release a NES computer instance initialized with nes_init(), dropping its reference
+// to the cartridge. The memory itself belongs to the caller.
+void nes_release(struct nes* computer);
+
+// Create a new NES computer instance on the heap.
 struct nes* nes_alloc();
 
-// Free a NES computer instance.
+// Free a NES computer instance, dropping its reference to the cartridge.
 void nes_free(struct nes* computer);
\ No newline at end of file
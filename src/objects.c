@@ -0,0 +1,106 @@
+/*
+; Object export.
+;
+; The tile grid is walked the way the PPU walks the nametables while drawing: from the
+; tile that the temporary VRAM address (t) points at, stepping coarse X across and
+; coarse Y down, switching nametables as either wraps. Nametable and attribute bytes
+; are read over the PPU bus, so that the cartridge's mirroring applies.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "util.h"
+#include "ppu.h"
+#include "objects.h"
+
+// Decode the sprites in OAM.
+static void capture_sprites(struct ppu* ppu, struct objects_frame* frame)
+{
+    bool tall = ppu->ppuctrl.vars.sprite_size;
+    uint16_t table = ppu->ppuctrl.vars.sprite_pt_address_8x8 ? 0x1000 : 0x0000;
+    for (int i = 0; i < 0x40; ++i)
+    {
+        const struct oamdata* entry = &ppu->oam[i];
+        struct objects_sprite* sprite = &frame->sprites[i];
+        uint8_t tile = entry->tile_index.value;
+
+        // 8x16 sprites take their pattern table from bit 0 of the tile index, and
+        // always start on an even tile.
+        if (tall)
+            sprite->pattern = (tile & 0x01 ? 0x1000 : 0x0000) | (tile & 0xFE) << 4;
+        else
+            sprite->pattern = table | tile << 4;
+        sprite->y = entry->y + 1;
+        sprite->x = entry->x;
+        sprite->tile = tile;
+        sprite->palette = 4 + entry->attributes.vars.palette;
+        sprite->flags = (sprite->y < NES_H ? OBJECTS_SPRITE_VISIBLE : 0)
+            | (entry->attributes.vars.priority ? OBJECTS_SPRITE_BEHIND : 0)
+            | (entry->attributes.vars.flip_horizontally ? OBJECTS_SPRITE_FLIP_H : 0)
+            | (entry->attributes.vars.flip_vertically ? OBJECTS_SPRITE_FLIP_V : 0)
+            | (tall ? OBJECTS_SPRITE_TALL : 0);
+    }
+}
+
+// Decode the visible tiles of the nametables.
+static void capture_tiles(struct ppu* ppu, struct objects_frame* frame)
+{
+    uint16_t table = ppu->ppuctrl.vars.bg_pt_address ? 0x1000 : 0x0000;
+    uint8_t coarse_y = ppu->t.vars.coarse_y_scroll;
+    uint8_t nametable_y = ppu->t.vars.nametable_select & 0b10;
+    for (int row = 0; row < OBJECTS_TILES_H; ++row)
+    {
+        uint8_t coarse_x = ppu->t.vars.coarse_x_scroll;
+        uint8_t nametable_x = ppu->t.vars.nametable_select & 0b01;
+        for (int column = 0; column < OBJECTS_TILES_W; ++column)
+        {
+            // Read the tile index, then its 2-bit palette out of the attribute byte
+            // covering its 4x4 tile block.
+            struct objects_tile* tile = &frame->tiles[row][column];
+            uint16_t nametable = 0x2000 | (nametable_y | nametable_x) << 10;
+            tile->tile = ppu_bus_read(ppu, nametable | coarse_y << 5 | coarse_x);
+            tile->pattern = table | tile->tile << 4;
+            uint8_t attribute = ppu_bus_read(ppu, nametable | 0x3C0 | (coarse_y >> 2) << 3 | coarse_x >> 2);
+            tile->palette = (attribute >> ((coarse_y & 0b10) << 1 | (coarse_x & 0b10))) & 0b11;
+
+            // Step across, into the next nametable at the end of this one.
+            if (coarse_x == 31)
+            {
+                coarse_x = 0;
+                nametable_x ^= 0b01;
+            }
+            else
+                coarse_x++;
+        }
+
+        // Step down. The nametables are 30 tiles tall; rows 30 and 31 are the
+        // attribute table, which the PPU will draw from if scrolled there, then wrap
+        // without switching nametables.
+        if (coarse_y == 29)
+        {
+            coarse_y = 0;
+            nametable_y ^= 0b10;
+        }
+        else if (coarse_y == 31)
+            coarse_y = 0;
+        else
+            coarse_y++;
+    }
+}
+
+// Capture a NES's objects.
+void objects_capture(struct nes* computer, struct objects_frame* frame, uint32_t what)
+{
+    struct ppu* ppu = &computer->ppu;
+    frame->frame = computer->frame_count;
+    frame->scroll_x = (ppu->t.vars.nametable_select & 0b01) * NES_W + ppu->t.vars.coarse_x_scroll * 8 + ppu->x;
+    frame->scroll_y = (ppu->t.vars.nametable_select >> 1) * NES_H + ppu->t.vars.coarse_y_scroll * 8
+        + ppu->t.vars.fine_y_scroll;
+    frame->show = (ppu->ppumask.vars.background_rendering ? OBJECTS_SHOW_BACKGROUND : 0)
+        | (ppu->ppumask.vars.sprite_rendering ? OBJECTS_SHOW_SPRITES : 0);
+    if (what & OBJECTS_SPRITES)
+        capture_sprites(ppu, frame);
+    if (what & OBJECTS_TILES)
+        capture_tiles(ppu, frame);
+}
\ No newline at end of file
@@ -0,0 +1,77 @@
+/*
+; Object export: the picture as the PPU sees it, decoded into sprites and background
+; tiles rather than pixels, for agents and test oracles that want structured state.
+; It is read straight from OAM, the nametables and the scroll registers, so it costs
+; a few thousand byte reads a frame and works whether or not the frame was rendered.
+;
+; Taken between frames (after nes_frame()), it describes what the game set up during
+; vblank, which is what the next frame starts drawing from. Changes made while the
+; frame is drawn, such as split scrolling for a status bar, don't show up.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "nes.h"
+
+// Size of the background tile grid: the screen is 32x30 tiles, plus a column and a row
+// for the tiles that fine scrolling brings partly into view.
+#define OBJECTS_TILES_W         33
+#define OBJECTS_TILES_H         31
+
+// What to capture.
+#define OBJECTS_SPRITES         (1 << 0)
+#define OBJECTS_TILES           (1 << 1)
+#define OBJECTS_ALL             (OBJECTS_SPRITES | OBJECTS_TILES)
+
+// Sprite flags.
+#define OBJECTS_SPRITE_VISIBLE  (1 << 0)    // Its top line is on screen.
+#define OBJECTS_SPRITE_BEHIND   (1 << 1)    // Drawn behind the background.
+#define OBJECTS_SPRITE_FLIP_H   (1 << 2)
+#define OBJECTS_SPRITE_FLIP_V   (1 << 3)
+#define OBJECTS_SPRITE_TALL     (1 << 4)    // 8x16 rather than 8x8.
+
+// Rendering flags, from PPUMASK.
+#define OBJECTS_SHOW_BACKGROUND (1 << 0)
+#define OBJECTS_SHOW_SPRITES    (1 << 1)
+
+// A sprite, decoded from OAM.
+struct objects_sprite
+{
+    uint16_t pattern;           // Pattern table address of its (top) tile.
+    uint16_t y;                 // Top line on screen (OAM Y + 1).
+    uint8_t x;                  // Left column on screen.
+    uint8_t tile;               // Tile index, as in OAM.
+    uint8_t palette;            // Sprite palette, 4-7.
+    uint8_t flags;              // OBJECTS_SPRITE_*.
+};
+
+// A background tile, decoded from a nametable and its attribute table.
+struct objects_tile
+{
+    uint16_t pattern;           // Pattern table address of the tile.
+    uint8_t tile;               // Tile index, as in the nametable.
+    uint8_t palette;            // Background palette, 0-3.
+};
+
+// A frame's objects.
+struct objects_frame
+{
+    uint64_t frame;             // Number of frames emulated (see nes_frame_count()).
+
+    // Scroll of the screen's top-left pixel within the 512x480 plane of the four
+    // nametables. Tile (0, 0) of the grid is the one holding it, scroll_x % 8 and
+    // scroll_y % 8 pixels above and to the left of the screen's corner.
+    uint16_t scroll_x;
+    uint16_t scroll_y;
+    uint8_t show;               // OBJECTS_SHOW_*.
+
+    struct objects_sprite sprites[0x40];    // In OAM order, which is priority order.
+    struct objects_tile tiles[OBJECTS_TILES_H][OBJECTS_TILES_W];
+};
+
+// Capture a NES's objects: OBJECTS_SPRITES and/or OBJECTS_TILES, leaving the other
+// part of the frame as it is.
+void objects_capture(struct nes* computer, struct objects_frame* frame, uint32_t what);
\ No newline at end of file
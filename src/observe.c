@@ -0,0 +1,198 @@
+/*
+; Observations.
+;
+; A greyscale observation is made a row at a time: the luma of each crop column is
+; summed down the source rows the output row covers, looked up from the palette index
+; as it goes, then each output pixel averages the sums of its columns. Output pixels
+; cover whole source pixels, so their areas differ by a row or column at most when
+; the scale isn't a whole number.
+;
+; The luma lookup is a gather, which SSE2 has no instruction for. Instead, pixels are
+; taken two at a time: a table indexed by both their palette indices gives both their
+; lumas as the 16-bit halves of a word, which is added to two column sums at once
+; (no sum can carry into the next, as it is at most 255 * NES_H). That is half the
+; loads and adds of a pixel at a time, and the full RGBA frame never comes into it.
+*/
+
+#include <stdio.h>
+#include <memory.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <assert.h>
+
+#include "util.h"
+#include "ppu.h"
+#include "observe.h"
+
+// Reciprocals of the output pixel areas are scaled by 2^OBSERVE_RECIP_SHIFT, which
+// makes dividing by them exact for any sum of lumas over the area.
+#define OBSERVE_RECIP_SHIFT     40
+
+// Internal error message buffer.
+static char error_msg[128];
+
+// Add the luma of a row of palette indices to the pairs of column sums.
+static void add_row(const struct observe* obs, uint32_t* pairs, const uint8_t* indices)
+{
+    uint32_t count = obs->crop.w / 2;
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        uint16_t key;
+        memcpy(&key, indices + i * 2, sizeof(key));
+        pairs[i] += obs->luma_pairs[key];
+    }
+    if (obs->crop.w % 2)
+        pairs[count] += obs->luma[indices[count * 2]];
+}
+
+// Make a greyscale observation.
+static void observe_grey(const struct observe* obs, const uint8_t* indices, uint8_t* out)
+{
+    uint32_t pairs[NES_W / 2];
+    uint32_t totals[NES_W + 1];
+    totals[0] = 0;
+    for (uint32_t r = 0; r < obs->h; ++r)
+    {
+        // Sum the luma of each crop column down the output row.
+        memset(pairs, 0, sizeof(pairs));
+        for (uint32_t y = obs->row_starts[r]; y < obs->row_starts[r + 1]; ++y)
+            add_row(obs, pairs, indices + (obs->crop.y + y) * NES_W + obs->crop.x);
+
+        // Total up the column sums from the left, so that any run of columns sums up
+        // with a subtraction.
+        for (uint32_t x = 0; x < obs->crop.w; ++x)
+            totals[x + 1] = totals[x] + ((pairs[x / 2] >> (x % 2 * 16)) & 0xFFFF);
+
+        // The output pixels of the row are one of two widths, so there are only two
+        // areas to divide by.
+        uint32_t rows = obs->row_starts[r + 1] - obs->row_starts[r];
+        uint32_t areas[2] = { obs->col_width * rows, (obs->col_width + 1) * rows };
+        uint64_t recips[2];
+        for (int i = 0; i < 2; ++i)
+            recips[i] = ((1ull << OBSERVE_RECIP_SHIFT) + areas[i] - 1) / areas[i];
+
+        // Average each output pixel's columns, rounding to nearest.
+        for (uint32_t c = 0; c < obs->w; ++c)
+        {
+            uint32_t sum = totals[obs->col_starts[c + 1]] - totals[obs->col_starts[c]];
+            uint32_t wide = obs->col_starts[c + 1] - obs->col_starts[c] - obs->col_width;
+            *out++ = (uint8_t)(((sum + areas[wide] / 2) * recips[wide]) >> OBSERVE_RECIP_SHIFT);
+        }
+    }
+}
+
+// Make a palette index observation.
+static void observe_index(const struct observe* obs, const uint8_t* indices, uint8_t* out)
+{
+    for (uint32_t r = 0; r < obs->h; ++r)
+    {
+        uint32_t y = (obs->row_starts[r] + obs->row_starts[r + 1] - 1) / 2;
+        const uint8_t* row = indices + (obs->crop.y + y) * NES_W + obs->crop.x;
+        for (uint32_t c = 0; c < obs->w; ++c)
+            *out++ = row[(obs->col_starts[c] + obs->col_starts[c + 1] - 1) / 2];
+    }
+}
+
+// Make an observation of a frame.
+void observe_frame(const struct observe* obs, const uint8_t* indices, uint8_t* out)
+{
+    if (obs->format == OBSERVE_GREY)
+        observe_grey(obs, indices, out);
+    else
+        observe_index(obs, indices, out);
+}
+
+// Set up a frame stack.
+void observe_stack_init(struct observe_stack* stack, void* frames, size_t frame_size, uint32_t depth)
+{
+    assert(depth);
+    memset(stack, 0, sizeof(struct observe_stack));
+    stack->frames = frames;
+    stack->frame_size = frame_size;
+    stack->depth = depth;
+}
+
+// Make an observation into the next slot of a frame stack.
+uint8_t* observe_push(const struct observe* obs, struct observe_stack* stack, const uint8_t* indices)
+{
+    assert(observe_size(obs) <= stack->frame_size);
+    uint8_t* frame = stack->frames + stack->next * stack->frame_size;
+    observe_frame(obs, indices, frame);
+    stack->next = (stack->next + 1) % stack->depth;
+    stack->pushed++;
+    return frame;
+}
+
+// Get an observation from a frame stack.
+const uint8_t* observe_stack_frame(const struct observe_stack* stack, uint32_t age)
+{
+    if (stack->pushed == 0)
+        return NULL;
+    age = (uint32_t)min(age, min(stack->pushed, stack->depth) - 1);
+    uint32_t slot = (stack->next + stack->depth - 1 - age) % stack->depth;
+    return stack->frames + slot * stack->frame_size;
+}
+
+// Create a new observation kernel.
+struct observe* observe_alloc(enum observe_format format, const struct observe_rect* crop, uint32_t w, uint32_t h)
+{
+    // Check the geometry.
+    struct observe_rect frame = { 0, 0, NES_W, NES_H };
+    if (crop == NULL)
+        crop = &frame;
+    if (crop->w == 0 || crop->h == 0 || crop->w > NES_W || crop->h > NES_H
+        || crop->x > NES_W - crop->w || crop->y > NES_H - crop->h)
+    {
+        snprintf(error_msg, sizeof(error_msg), "crop %ux%u+%u+%u is outside the %ux%u frame",
+            crop->w, crop->h, crop->x, crop->y, NES_W, NES_H);
+        return NULL;
+    }
+    if (w == 0 || h == 0 || w > crop->w || h > crop->h)
+    {
+        snprintf(error_msg, sizeof(error_msg), "observations must be between 1x1 and the %ux%u crop, not %ux%u",
+            crop->w, crop->h, w, h);
+        return NULL;
+    }
+
+    // Split the crop among the output pixels, and work out the luma of each colour.
+    struct observe* obs = safe_malloc(sizeof(struct observe));
+    obs->format = format;
+    obs->crop = *crop;
+    obs->w = w;
+    obs->h = h;
+    for (uint32_t c = 0; c <= w; ++c)
+        obs->col_starts[c] = (uint16_t)(c * crop->w / w);
+    for (uint32_t r = 0; r <= h; ++r)
+        obs->row_starts[r] = (uint16_t)(r * crop->h / h);
+    obs->col_width = crop->w / w;
+    for (int i = 0; i < 64; ++i)
+    {
+        struct agbr8888 colour = ppu_palette_colour((uint8_t)i);
+        obs->luma[i] = (uint8_t)((77 * colour.r + 150 * colour.g + 29 * colour.b + 128) >> 8);
+    }
+
+    // Pair up the lumas, keyed by two palette indices as they lie in memory.
+    for (int first = 0; first < 64; ++first)
+    {
+        for (int second = 0; second < 64; ++second)
+        {
+            uint8_t pixels[2] = { (uint8_t)first, (uint8_t)second };
+            uint16_t key;
+            memcpy(&key, pixels, sizeof(key));
+            obs->luma_pairs[key] = obs->luma[first] | (uint32_t)obs->luma[second] << 16;
+        }
+    }
+    return obs;
+}
+
+// Free an observation kernel.
+void observe_free(struct observe* obs)
+{
+    free(obs);
+}
+
+// Get the last error message.
+const char* observe_error_msg()
+{
+    return error_msg;
+}
\ No newline at end of file
@@ -0,0 +1,92 @@
+/*
+; Observations: small greyscale or palette index images made from each frame, for
+; agents that learn from the screen. They are made straight from the palette indices
+; the PPU writes (see nes_setindices()), cropped and downsampled in one pass, so the
+; RGBA frame never has to be rendered. A frame stack keeps the last few observations
+; in memory the caller provides.
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "constants.h"
+
+// Observation formats. Both take up a byte per pixel.
+enum observe_format
+{
+    OBSERVE_GREY,               // Luma (BT.601, full range), averaged over each pixel's area.
+    OBSERVE_INDEX               // Palette index of the source pixel at each pixel's centre.
+};
+
+// A rectangle of the frame.
+struct observe_rect
+{
+    uint32_t x;
+    uint32_t y;
+    uint32_t w;
+    uint32_t h;
+};
+
+// Observation kernel struct definition.
+struct observe
+{
+    enum observe_format format;
+    struct observe_rect crop;   // Part of the frame observed.
+    uint32_t w;                 // Size of the observations, no bigger than the crop.
+    uint32_t h;
+
+    // Output column n covers crop columns [col_starts[n], col_starts[n + 1]), and
+    // likewise for the rows.
+    uint16_t col_starts[NES_W + 1];
+    uint16_t row_starts[NES_H + 1];
+    uint32_t col_width;         // Narrowest output column, in crop columns.
+
+    // Luma of each palette index, and of each pair of palette indices side by side,
+    // keyed by the two bytes as a 16-bit word (see observe.c).
+    uint8_t luma[64];
+    uint32_t luma_pairs[0x4000];
+};
+
+// Frame stack: a ring of the last depth observations.
+struct observe_stack
+{
+    uint8_t* frames;            // depth observations, back to back; the caller's memory.
+    size_t frame_size;
+    uint32_t depth;
+    uint32_t next;              // Slot the next observation goes into.
+    uint64_t pushed;            // Number of observations pushed.
+};
+
+// Get the size of an observation, in bytes.
+inline size_t observe_size(const struct observe* obs)
+{
+    return (size_t)obs->w * obs->h;
+}
+
+// Make an observation of a frame's 6-bit palette indices (NES_H rows of NES_W).
+void observe_frame(const struct observe* obs, const uint8_t* indices, uint8_t* out);
+
+// Set up a frame stack in depth * frame_size bytes of the caller's memory.
+void observe_stack_init(struct observe_stack* stack, void* frames, size_t frame_size, uint32_t depth);
+
+// Make an observation of a frame straight into the next slot of a frame stack,
+// returning it.
+uint8_t* observe_push(const struct observe* obs, struct observe_stack* stack, const uint8_t* indices);
+
+// Get an observation from a frame stack: 0 is the newest. Before the stack has
+// filled, the older ones repeat the oldest pushed. NULL if none has been pushed.
+const uint8_t* observe_stack_frame(const struct observe_stack* stack, uint32_t age);
+
+// Create a new observation kernel. crop is the part of the frame observed (NULL: all
+// of it), and w x h the size to scale it down to. Returns NULL on failure; see
+// observe_error_msg().
+struct observe* observe_alloc(enum observe_format format, const struct observe_rect* crop, uint32_t w, uint32_t h);
+
+// Free an observation kernel.
+void observe_free(struct observe* obs);
+
+// Get the last error message.
+const char* observe_error_msg();
\ No newline at end of file
@@ -0,0 +1,205 @@
+/*
+; Instance pool.
+;
+; The awake machines are kept in a doubly linked list in order of use, so that both
+; touching a machine and finding the least recently used one take constant time.
+; The most recently used machine is never hibernated to make room, so a runner can
+; always step the machine it has just got, however low the cap is.
+*/
+
+#include <memory.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <assert.h>
+
+#include "util.h"
+#include "pool.h"
+
+// Unlink an awake machine from the list of awake machines.
+static void unlink_awake(struct pool* pool, uint32_t id)
+{
+    struct pool_instance* instance = &pool->instances[id];
+    if (instance->prev != POOL_NONE)
+        pool->instances[instance->prev].next = instance->next;
+    else
+        pool->head = instance->next;
+    if (instance->next != POOL_NONE)
+        pool->instances[instance->next].prev = instance->prev;
+    else
+        pool->tail = instance->prev;
+}
+
+// Link an awake machine in as the most recently used.
+static void link_awake(struct pool* pool, uint32_t id)
+{
+    struct pool_instance* instance = &pool->instances[id];
+    instance->prev = POOL_NONE;
+    instance->next = pool->head;
+    if (pool->head != POOL_NONE)
+        pool->instances[pool->head].prev = id;
+    else
+        pool->tail = id;
+    pool->head = id;
+}
+
+// Hibernate the least recently used machines until the pool is under the memory cap.
+static void enforce_cap(struct pool* pool)
+{
+    while (pool->memory_cap && pool->memory > pool->memory_cap && pool->tail != pool->head)
+        pool_hibernate(pool, pool->tail);
+}
+
+// Add a new machine to the pool.
+uint32_t pool_add(struct pool* pool, struct cartridge* cartridge)
+{
+    // Take a free slot, growing the instance buffer if there are none.
+    uint32_t id = pool->free;
+    if (id != POOL_NONE)
+        pool->free = pool->instances[id].next;
+    else
+    {
+        if (pool->count == pool->capacity)
+        {
+            pool->capacity = pool->capacity ? pool->capacity * 2 : 16;
+            struct pool_instance* instances = safe_calloc(pool->capacity, sizeof(struct pool_instance));
+            memcpy(instances, pool->instances, pool->count * sizeof(struct pool_instance));
+            free(pool->instances);
+            pool->instances = instances;
+        }
+        id = pool->count++;
+    }
+
+    // Set up the machine.
+    struct pool_instance* instance = &pool->instances[id];
+    memset(instance, 0, sizeof(struct pool_instance));
+    instance->used = true;
+    instance->computer = nes_alloc();
+    nes_setcartridge(instance->computer, cartridge);
+    nes_reset(instance->computer);
+    link_awake(pool, id);
+    pool->memory += sizeof(struct nes);
+    pool->awake++;
+    enforce_cap(pool);
+    return id;
+}
+
+// Get a machine to run.
+struct nes* pool_get(struct pool* pool, uint32_t id)
+{
+    assert(id < pool->count && pool->instances[id].used);
+    struct pool_instance* instance = &pool->instances[id];
+    if (instance->computer)
+    {
+        // Awake: just make it the most recently used.
+        unlink_awake(pool, id);
+        link_awake(pool, id);
+        return instance->computer;
+    }
+
+    // Wake it: put back the host bindings, then the state. The blob was made by this
+    // process, so it can't be corrupt.
+    struct nes* computer = safe_malloc(sizeof(struct nes));
+    memcpy((uint8_t*)computer + NES_STATE_SIZE, instance->host, sizeof(instance->host));
+    bool woken = nes_wake(computer, instance->blob, instance->blob_size);
+    assert(woken);
+    (void)woken;
+    free(instance->blob);
+    pool->memory += sizeof(struct nes) - instance->blob_size;
+    instance->computer = computer;
+    instance->blob = NULL;
+    instance->blob_size = 0;
+    link_awake(pool, id);
+    pool->awake++;
+    pool->hibernating--;
+    pool->wakes++;
+    enforce_cap(pool);
+    return computer;
+}
+
+// Hibernate a machine.
+void pool_hibernate(struct pool* pool, uint32_t id)
+{
+    assert(id < pool->count && pool->instances[id].used);
+    struct pool_instance* instance = &pool->instances[id];
+    if (instance->computer == NULL)
+        return;
+
+    // Compress the state and keep the host bindings, then free the machine without
+    // releasing it, so that its cartridge reference stays with the bindings.
+    instance->blob = nes_hibernate(instance->computer, &instance->blob_size);
+    memcpy(instance->host, (uint8_t*)instance->computer + NES_STATE_SIZE, sizeof(instance->host));
+    free(instance->computer);
+    instance->computer = NULL;
+    unlink_awake(pool, id);
+    pool->memory -= sizeof(struct nes) - instance->blob_size;
+    pool->awake--;
+    pool->hibernating++;
+    pool->hibernations++;
+}
+
+// Remove a machine from the pool.
+void pool_remove(struct pool* pool, uint32_t id)
+{
+    assert(id < pool->count && pool->instances[id].used);
+    struct pool_instance* instance = &pool->instances[id];
+
+    // Release the machine. A hibernating one isn't woken just to be thrown away (and
+    // possibly hibernate others to make room): its blob is freed, and the cartridge
+    // reference kept with its host bindings dropped.
+    if (instance->computer)
+    {
+        unlink_awake(pool, id);
+        nes_free(instance->computer);
+        pool->memory -= sizeof(struct nes);
+        pool->awake--;
+    }
+    else
+    {
+        struct cartridge* cartridge;
+        memcpy(&cartridge, instance->host + offsetof(struct nes, cartridge) - NES_STATE_SIZE, sizeof(cartridge));
+        cartridge_free(cartridge);
+        free(instance->blob);
+        pool->memory -= instance->blob_size;
+        pool->hibernating--;
+    }
+
+    // Free up the slot.
+    instance->used = false;
+    instance->computer = NULL;
+    instance->blob = NULL;
+    instance->blob_size = 0;
+    instance->next = pool->free;
+    pool->free = id;
+}
+
+// Set the memory cap.
+void pool_setcap(struct pool* pool, size_t memory_cap)
+{
+    pool->memory_cap = memory_cap;
+    enforce_cap(pool);
+}
+
+// Create a new, empty instance pool.
+struct pool* pool_alloc(size_t memory_cap)
+{
+    struct pool* pool = safe_malloc(sizeof(struct pool));
+    pool->free = POOL_NONE;
+    pool->head = POOL_NONE;
+    pool->tail = POOL_NONE;
+    pool->memory_cap = memory_cap;
+    return pool;
+}
+
+// Free an instance pool.
+void pool_free(struct pool* pool)
+{
+    if (pool == NULL)
+        return;
+    for (uint32_t id = 0; id < pool->count; ++id)
+    {
+        if (pool->instances[id].used)
+            pool_remove(pool, id);
+    }
+    free(pool->instances);
+    free(pool);
+}
\ No newline at end of file
@@ -0,0 +1,85 @@
+/*
+; Instance pool: a set of NES machines for runners juggling many sessions at once.
+; Idle machines can be hibernated, compressing their state out of memory, and are
+; woken again the next time they are asked for; under a memory cap, the least
+; recently used machines are hibernated automatically.
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "nes.h"
+
+// Marks the end of a list of instances.
+#define POOL_NONE               0xFFFFFFFF
+
+// A pooled instance.
+struct pool_instance
+{
+    bool used;                  // Unset for a free slot.
+
+    // Awake: the machine. Hibernating: its state as a blob (see nes_hibernate()), and
+    // its host bindings, which keep their reference to the cartridge.
+    struct nes* computer;
+    uint8_t* blob;
+    size_t blob_size;
+    uint8_t host[sizeof(struct nes) - NES_STATE_SIZE];
+
+    // Awake machines, from the most to the least recently used. Free slots are
+    // chained through next.
+    uint32_t prev;
+    uint32_t next;
+};
+
+// Instance pool struct definition.
+struct pool
+{
+    struct pool_instance* instances;
+    uint32_t count;             // Number of slots, used or free.
+    uint32_t capacity;
+    uint32_t free;              // First free slot (POOL_NONE: none).
+
+    // Awake machines, most recently used first.
+    uint32_t head;
+    uint32_t tail;
+
+    // Memory taken up by the machines and blobs, and the cap to keep it under
+    // (0: none).
+    size_t memory;
+    size_t memory_cap;
+
+    // Statistics.
+    uint32_t awake;
+    uint32_t hibernating;
+    uint64_t hibernations;
+    uint64_t wakes;
+};
+
+// Add a new machine to the pool, with the cartridge inserted and reset, returning its
+// ID. It counts as the most recently used machine.
+uint32_t pool_add(struct pool* pool, struct cartridge* cartridge);
+
+// Get a machine to run, waking it if it is hibernating. Any other machine may be
+// hibernated to keep under the memory cap, so only the pointer of the machine last
+// got is certain to stay valid.
+struct nes* pool_get(struct pool* pool, uint32_t id);
+
+// Hibernate a machine, freeing it after compressing its state. Its host bindings are
+// kept, and are back in place when it wakes.
+void pool_hibernate(struct pool* pool, uint32_t id);
+
+// Remove a machine from the pool, dropping its reference to the cartridge. The ID
+// may be reused.
+void pool_remove(struct pool* pool, uint32_t id);
+
+// Set the memory cap (0: none), hibernating machines until the pool is under it.
+void pool_setcap(struct pool* pool, size_t memory_cap);
+
+// Create a new, empty instance pool.
+struct pool* pool_alloc(size_t memory_cap);
+
+// Free an instance pool, along with every machine in it.
+void pool_free(struct pool* pool);
\ No newline at end of file
@@ -5,11 +5,14 @@
 
 // TODO work on other PPUMASK features.
 
+#include <memory.h>
 #include <stdint.h>
 #include <stdbool.h>
 
 #include "util.h"
 #include "ppu.h"
+#include "nes.h"
+#include "profile.h"
 
 // Internal enum for deciding the current timing stage.
 enum timing
@@ -136,7 +139,7 @@ static inline enum timing ppu_timing(struct ppu* ppu)
 // depending on the given mapper's mirror type.
 static uint16_t vram_mirror(struct ppu* ppu, uint16_t address)
 {
-    enum mirror_type mirror = cartridge_mirror_type(ppu->computer->cartridge);
+    enum mirror_type mirror = cartridge_mirror_type(ppu_nes(ppu)->cartridge);
     address &= 0x0FFF;
     if (mirror == MIRROR_HORIZONTAL)
     {
@@ -169,6 +172,12 @@ static void ppu_reload_shifters(struct ppu* ppu)
         | (ppu->bg_next_attribute_data & 0b10 ? 0xFF : 0x00);
 }
 
+// Get the colour of a 6-bit palette index.
+struct agbr8888 ppu_palette_colour(uint8_t index)
+{
+    return palette_lookup[index & 0x3F];
+}
+
 // Reset the PPU.
 void ppu_reset(struct ppu* ppu)
 {
@@ -199,7 +208,7 @@ uint8_t ppu_bus_read(struct ppu* ppu, uint16_t address)
 
     // Attempt to read from the cartridge.
     uint8_t byte;
-    if (cartridge_ppu_read(ppu->computer->cartridge, address, &byte))
+    if (cartridge_ppu_read(ppu_nes(ppu)->cartridge, address, &byte))
         return byte;
 
     // $2000-$2FFF: nametables 0-3.
@@ -232,13 +241,17 @@ void ppu_bus_write(struct ppu* ppu, uint16_t address, uint8_t byte)
     address &= 0x3FFF;
 
     // Attempt to write to the cartridge.
-    if (cartridge_ppu_write(ppu->computer->cartridge, address, byte))
+    if (cartridge_ppu_write(ppu_nes(ppu)->cartridge, address, byte))
         return;
 
     // $2000-$2FFF: nametables 0-3.
     // $3000-$3EFF: usually a mirror of this region of memory.
     else if (0x2000 <= address && address <= 0x3EFF)
-        ppu->vram[vram_mirror(ppu, address)] = byte;
+    {
+        uint16_t index = vram_mirror(ppu, address);
+        ppu->vram[index] = byte;
+        nes_hash_dirty(ppu_nes(ppu), NES_HASH_PAGE_VRAM + index / NES_HASH_PAGE_SIZE);
+    }
 
     // $3F00-$3FFF: palette RAM.
     else if (0x3F00 <= address && address <= 0x3FFF)
@@ -251,6 +264,7 @@ void ppu_bus_write(struct ppu* ppu, uint16_t address, uint8_t byte)
 
         // Set the palette RAM index.
         ppu->palette_ram[address] = byte;
+        nes_hash_dirty(ppu_nes(ppu), NES_HASH_PAGE_PALETTE);
     }
 
     // Open bus.
@@ -277,7 +291,7 @@ uint8_t ppu_cpu_read(struct ppu* ppu, uint16_t address)
     // OAMDATA
     case 0x0004:
     {
-        return ppu->oam_byte_pointer[ppu->oamaddr];
+        return ppu_oam_bytes(ppu)[ppu->oamaddr];
     }
 
     // PPUDATA
@@ -334,7 +348,8 @@ void ppu_cpu_write(struct ppu* ppu, uint16_t address, uint8_t byte)
     // OAMDATA
     case 0x0004:
     {
-        ppu->oam_byte_pointer[ppu->oamaddr++] = byte;
+        ppu_oam_bytes(ppu)[ppu->oamaddr++] = byte;
+        nes_hash_dirty(ppu_nes(ppu), NES_HASH_PAGE_OAM);
         return;
     }
 
@@ -420,6 +435,8 @@ void ppu_clock(struct ppu* ppu)
         // Cycles 1-256 and 321-336: fetch background data.
         if ((1 <= ppu->cycle && ppu->cycle <= 256) || (321 <= ppu->cycle && ppu->cycle <= 336))
         {
+            PROFILE_BEGIN(fetch_start);
+
             // Process each 8-cycle window for the next tile.
             // Admittedly, this was quite a lot to digest, so I'll try to comment this a bit more.
             // For each 8-cycle window, the following actions are taken:
@@ -535,25 +552,33 @@ void ppu_clock(struct ppu* ppu)
                 }
                 break;
             }
+
+            PROFILE_END(fetch_start, PROFILE_PPU_FETCH);
         }
 
         // Cycles 1-64: initialize secondary OAM buffer and reset other sprite-specific 
         // data here.
         if (1 <= ppu->cycle && ppu->cycle <= 64)
         {
+            PROFILE_BEGIN(clear_start);
+
             if ((ppu->cycle & 1) == 0)
-                ppu->oam_secondary_byte_pointer[(ppu->cycle - 1) / 2] = 0xFF;
+                ppu_oam_secondary_bytes(ppu)[(ppu->cycle - 1) / 2] = 0xFF;
             ppu->sp_sprite_0_copied = false;
             ppu->sp_enumerated = 0;
             ppu->sp_count = 0;
             ppu->sp_byte_copy = 0;
             ppu->sp_fetched_count = 0;
+
+            PROFILE_END(clear_start, PROFILE_PPU_SPRITE_EVAL);
         }
 
         // Cycles 65-256 (excluding the pre-render scanline): sprite evaluation.
         if (65 <= ppu->cycle && ppu->cycle <= 256 && ppu->sp_enumerated < 64 && (ppu->cycle & 1) == 0
             && ppu->scanline != -1)
         {
+            PROFILE_BEGIN(eval_start);
+
             // Handle copying to secondary OAM first. Combine odd (reading) and even 
             // (writing) cycles together.
             if (ppu->sp_count < 8)
@@ -561,8 +586,8 @@ void ppu_clock(struct ppu* ppu)
                 // If sprite bytes must be copied from primary to secondary OAM, do so.
                 if (ppu->sp_byte_copy > 0)
                 {
-                    ppu->oam_secondary_byte_pointer[ppu->sp_count * 4 + ppu->sp_byte_copy]
-                        = ppu->oam_byte_pointer[ppu->sp_enumerated * 4 + ppu->sp_byte_copy];
+                    ppu_oam_secondary_bytes(ppu)[ppu->sp_count * 4 + ppu->sp_byte_copy]
+                        = ppu_oam_bytes(ppu)[ppu->sp_enumerated * 4 + ppu->sp_byte_copy];
                     if (ppu->sp_byte_copy == 3)
                     {
                         ppu->sp_byte_copy = 0;
@@ -595,7 +620,7 @@ void ppu_clock(struct ppu* ppu)
                 // If 8 visible sprites were found, search for a 9th sprite. Unfortunately,
                 // due to a hardware bug, this is unpredictable and it incorrectly evaluates
                 // whether sprite overflow has occurred.
-                int16_t diff = ppu->scanline - ppu->oam_byte_pointer[
+                int16_t diff = ppu->scanline - ppu_oam_bytes(ppu)[
                     ppu->sp_enumerated * 4 + ppu->sp_byte_copy];
                 if (0 <= diff && diff < (ppu->ppuctrl.vars.sprite_size ? 0x10 : 0x8))
                     ppu->ppustatus.vars.sprite_overflow_flag = 1;
@@ -608,11 +633,15 @@ void ppu_clock(struct ppu* ppu)
                     ppu->sp_byte_copy = (ppu->sp_byte_copy + 1) % 4;
                 }
             }
+
+            PROFILE_END(eval_start, PROFILE_PPU_SPRITE_EVAL);
         }
 
         // Cycles 257-320: fetch sprite data into latches for the next scanline.
         if (257 <= ppu->cycle && ppu->cycle <= 320)
         {
+            PROFILE_BEGIN(sprite_fetch_start);
+
             // This is very similar to fetching background data, however the nametable
             // bytes are garbage reads and the fetched pattern table data is for the
             // sprites instead. The tile data is from each secondary OAM entry's
@@ -766,6 +795,8 @@ void ppu_clock(struct ppu* ppu)
                 break;
             }
             }
+
+            PROFILE_END(sprite_fetch_start, PROFILE_PPU_FETCH);
         }
 
         // Cycle 256: fine Y scroll.
@@ -829,10 +860,16 @@ void ppu_clock(struct ppu* ppu)
     }
     }
 
-    // If within the NES resolution, render this pixel.
+    // If within the NES resolution, render this pixel. When the frame is being skipped,
+    // the pixel only needs to be composed if it could still raise the sprite 0 hit flag,
+    // as games poll that flag to time raster effects.
     int x = ppu->cycle - 1, y = ppu->scanline;
-    if (0 <= y && y < NES_H && 0 <= x && x < NES_W)
+    struct nes* computer = ppu_nes(ppu);
+    if (0 <= y && y < NES_H && 0 <= x && x < NES_W && (!computer->render_skip
+        || (ppu->sp_sprite_0_latch && !ppu->ppustatus.vars.sprite_0_hit_flag)))
     {
+        PROFILE_BEGIN(compose_start);
+
         // Generate the 4-bit background pixel.
         // The default values are 0, assuming that EXT is grounded, since EXT 
         // will not be emulated here.
@@ -915,8 +952,19 @@ void ppu_clock(struct ppu* ppu)
         }
 
         // Finally, read into palette RAM and blit the pixel.
-        ppu->screen[ppu->scanline][ppu->cycle - 1] = palette_lookup[
-            ppu_bus_read(ppu, 0x3F00 | pixel) & 0x3F];
+        if (!computer->render_skip)
+        {
+            uint8_t index = ppu_bus_read(ppu, 0x3F00 | pixel) & 0x3F;
+            if (computer->screen)
+            {
+                struct agbr8888* row = (struct agbr8888*)((uint8_t*)computer->screen + y * computer->screen_pitch);
+                row[x] = palette_lookup[index];
+            }
+            if (computer->screen_indices)
+                computer->screen_indices[y * NES_W + x] = index;
+        }
+
+        PROFILE_END(compose_start, PROFILE_PPU_COMPOSE);
     }
 
     // Cycles 1-256 and 321-336: shift the background shift registers, after the dot has
@@ -955,26 +1003,9 @@ void ppu_clock(struct ppu* ppu)
     ppu->cycle = (ppu->cycle + 1) % 341;
 }
 
-// Create a new PPU instance. The PPU must be reset before used.
-struct ppu* ppu_alloc()
-{
-    // Allocate a new PPU instance.
-    struct ppu* ppu = safe_malloc(sizeof(struct ppu));
-
-    // As safe_malloc() uses calloc() internally, the registers should already
-    // be set to zero.
-
-    // Set the OAM byte pointesr to the addresses of the OAM buffers. This is necessary
-    // for OAMADDR/OAMDATA and sprite evaluation.
-    ppu->oam_byte_pointer = (uint8_t*)&ppu->oam;
-    ppu->oam_secondary_byte_pointer = (uint8_t*)&ppu->oam_secondary;
-    
-    // Return the PPU.
-    return ppu;
-}
-
-// Free a PPU instance.
-void ppu_free(struct ppu* ppu)
+// Initialize a PPU in place. The PPU must be reset before used.
+void ppu_init(struct ppu* ppu)
 {
-    free(ppu);
+    // The registers start out as zero.
+    memset(ppu, 0, sizeof(struct ppu));
 }
\ No newline at end of file
@@ -9,7 +9,9 @@
 #include <stdbool.h>
 
 #include "constants.h"
-#include "nes.h"
+
+// Forward the NES computer struct.
+struct nes;
 
 // ABGR8888 colour type, so that the NES code is independent of SDL.
 struct agbr8888
@@ -38,16 +40,10 @@ union internal_vram_register
 // PPU struct definition.
 struct ppu
 {
-    // Bind the computer to the PPU.
-    struct nes* computer;
-
     // PPU RAM.
     uint8_t palette_ram[0x20];
     uint8_t vram[0x800];
 
-    // PPU screen.
-    struct agbr8888 screen[NES_H][NES_W];
-
     // PPU OAM.
     struct oamdata
     {
@@ -85,7 +81,6 @@ struct ppu
         // X position of the sprite (top-left).
         uint8_t x;
     } oam[0x40], oam_secondary[0x8];
-    uint8_t* oam_byte_pointer, *oam_secondary_byte_pointer;
     bool oam_executing_dma;
 
     // Register - PPUCTRL ($2000 write)
@@ -180,12 +175,21 @@ struct ppu
     uint64_t enumerated_cycles;
 };
 
-// Bind the computer to the PPU.
-inline void ppu_setnes(struct ppu* ppu, struct nes* computer)
+// Get the primary OAM as bytes, as OAMADDR/OAMDATA and sprite evaluation see it.
+inline uint8_t* ppu_oam_bytes(struct ppu* ppu)
+{
+    return (uint8_t*)ppu->oam;
+}
+
+// Get the secondary OAM as bytes.
+inline uint8_t* ppu_oam_secondary_bytes(struct ppu* ppu)
 {
-    ppu->computer = computer;
+    return (uint8_t*)ppu->oam_secondary;
 }
 
+// Get the colour of a 6-bit palette index.
+struct agbr8888 ppu_palette_colour(uint8_t index);
+
 // Reset the PPU.
 void ppu_reset(struct ppu* ppu);
 
@@ -204,8 +208,5 @@ void ppu_cpu_write(struct ppu* ppu, uint16_t address, uint8_t byte);
 // Execute a PPU clock.
 void ppu_clock(struct ppu* ppu);
 
-// Create a new PPU instance. The PPU must be reset before used.
-struct ppu* ppu_alloc();
-
-// Free a CPU instance.
-void ppu_free(struct ppu* ppu);
\ No newline at end of file
+// Initialize a PPU in place. The PPU must be reset before used.
+void ppu_init(struct ppu* ppu);
\ No newline at end of file
@@ -0,0 +1,89 @@
+/*
+; Per-subsystem profiler.
+;
+; The counters are plain globals rather than being per-thread or atomic, so that
+; timing a zone costs no more than two clock reads and two additions. Each zone is
+; only ever entered by one thread at a time (the present zone on the main thread,
+; the rest on the emulation thread), except during parallel exports, where the
+; counts are approximate.
+*/
+
+#include <stdio.h>
+#include <memory.h>
+#include <stdint.h>
+
+#include "util.h"
+#include "profile.h"
+
+// Per-zone counters.
+struct profile_counter profile_counters[PROFILE_ZONES];
+
+// Report state.
+static FILE* report_file;
+static uint32_t report_interval;
+static uint32_t frames;
+static uint64_t start_ticks;
+static uint64_t start_ns;
+
+// Zone names, as printed in the report.
+static const char* zone_names[PROFILE_ZONES] =
+{
+    "cpu",
+    "dma",
+    "ppu fetch",
+    "ppu sprite eval",
+    "ppu compose",
+    "mapper read",
+    "mapper write",
+    "present"
+};
+
+// Start over.
+static void profile_reset()
+{
+    memset(profile_counters, 0, sizeof(profile_counters));
+    frames = 0;
+    start_ns = get_ns_timestamp();
+    start_ticks = profile_ticks();
+}
+
+// Start profiling.
+void profile_init(uint32_t interval, FILE* file)
+{
+    report_file = file;
+    report_interval = interval;
+    profile_reset();
+}
+
+// Count an emulated frame.
+void profile_frame()
+{
+    if (++frames == report_interval)
+        profile_report();
+}
+
+// Print a report of everything counted since the last one.
+void profile_report()
+{
+    if (frames == 0)
+        return;
+
+    // Work out how long a tick is from the wall time that has passed.
+    uint64_t elapsed_ns = get_ns_timestamp() - start_ns;
+    uint64_t elapsed_ticks = profile_ticks() - start_ticks;
+    double ns_per_tick = elapsed_ticks ? (double)elapsed_ns / elapsed_ticks : 1.0;
+
+    // Print the zones.
+    FILE* file = report_file ? report_file : stdout;
+    fprintf(file, "profile: %u frame(s) in %.1fms\n", frames, (double)elapsed_ns / 1000000);
+    fprintf(file, "  %-16s %12s %10s %9s %9s %6s\n", "zone", "calls", "ms", "ns/call", "ms/frame", "%");
+    for (int i = 0; i < PROFILE_ZONES; ++i)
+    {
+        double ms = profile_counters[i].ticks * ns_per_tick / 1000000;
+        fprintf(file, "  %-16s %12llu %10.1f %9.1f %9.3f %6.1f\n", zone_names[i],
+            (unsigned long long)profile_counters[i].calls, ms,
+            profile_counters[i].calls ? ms * 1000000 / profile_counters[i].calls : 0.0,
+            frames ? ms / frames : 0.0, elapsed_ns ? ms * 100000000 / elapsed_ns : 0.0);
+    }
+    profile_reset();
+}
\ No newline at end of file
@@ -0,0 +1,82 @@
+/*
+; Per-subsystem profiler. Accumulates host time and call counts for each of the
+; core's subsystems, so that it's clear where the time of a frame goes.
+;
+; The profiler is compiled out unless NES_PROFILE is defined (see the NESEMU_PROFILE
+; CMake option), in which case every macro below expands to nothing.
+*/
+
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+
+// Profiled subsystems. Zones nest where the subsystems do: mapper reads and writes
+// are also counted in the CPU or PPU zone that issued them.
+enum profile_zone
+{
+    PROFILE_CPU,                // CPU instruction execution.
+    PROFILE_DMA,                // OAM DMA transfers.
+    PROFILE_PPU_FETCH,          // PPU background and sprite pattern fetches.
+    PROFILE_PPU_SPRITE_EVAL,    // PPU secondary OAM clearing and sprite evaluation.
+    PROFILE_PPU_COMPOSE,        // PPU pixel composition and output.
+    PROFILE_MAPPER_READ,        // Cartridge reads, from either bus.
+    PROFILE_MAPPER_WRITE,       // Cartridge writes, from either bus.
+    PROFILE_PRESENT,            // Frontend frame presentation.
+    PROFILE_ZONES
+};
+
+#ifdef NES_PROFILE
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__i386__) || defined(__x86_64__)
+#include <x86intrin.h>
+#else
+#include "util.h"
+#endif
+
+// Per-zone counters.
+struct profile_counter
+{
+    uint64_t ticks;             // Host time spent in the zone, in profile_ticks() units.
+    uint64_t calls;             // Number of times the zone was entered.
+};
+extern struct profile_counter profile_counters[PROFILE_ZONES];
+
+// Read the host's cheapest high-resolution clock: the TSC where there is one, or the
+// nanosecond timestamp otherwise.
+inline uint64_t profile_ticks()
+{
+#if defined(_M_X64) || defined(_M_IX86) || defined(__i386__) || defined(__x86_64__)
+    return __rdtsc();
+#else
+    return get_ns_timestamp();
+#endif
+}
+
+// Time a stretch of code, attributing it to a zone. The variable holds the start
+// time, so that several stretches can be timed within a function.
+#define PROFILE_BEGIN(var)          uint64_t var = profile_ticks()
+#define PROFILE_END(var, zone)      do { profile_counters[zone].ticks += profile_ticks() - (var); \
+                                        profile_counters[zone].calls++; } while (0)
+
+// Start profiling. A report is printed every interval frames (0: only on request).
+void profile_init(uint32_t interval, FILE* file);
+
+// Count an emulated frame, printing a report and starting over every interval frames.
+void profile_frame();
+
+// Print a report of everything counted since the last one, if any frames have been
+// emulated since, and start over.
+void profile_report();
+
+#else
+
+#define PROFILE_BEGIN(var)
+#define PROFILE_END(var, zone)
+#define profile_init(interval, file)    ((void)0)
+#define profile_frame()                 ((void)0)
+#define profile_report()                ((void)0)
+
+#endif
\ No newline at end of file
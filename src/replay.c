@@ -0,0 +1,207 @@
+/*
+; Parallel replay rendering.
+;
+; Rendering a movie is inherently sequential, as every frame depends on the one
+; before it. To get around this, the movie is first run through once with rendering
+; skipped, capturing a keyframe at the start of every segment. Each segment can then
+; be rendered from its keyframe independently of the others, so the segments are
+; handed out to worker threads, and stitched back together in order on the calling
+; thread as they complete.
+;
+; The workers all share the cartridge of the computer given (see struct cartridge).
+*/
+
+#include <stdio.h>
+#include <memory.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "SDL.h"
+
+#include "util.h"
+#include "keyframes.h"
+#include "replay.h"
+
+// Internal error message buffer.
+static char error_msg[128];
+
+// A segment buffer.
+struct replay_slot
+{
+    struct agbr8888* frames;    // segment_frames frames of NES_W x NES_H pixels
+    bool done;                  // Set once a worker has rendered the segment into it.
+};
+
+// Shared replay rendering state.
+struct replay
+{
+    // Input.
+    struct cartridge* cartridge;
+    struct movie* movie;
+    struct keyframes* keyframes;
+    uint32_t frame_count;
+    uint32_t segment_frames;
+    uint32_t segment_count;
+
+    // Segment buffers; segment n is rendered into slot n % slot_count.
+    struct replay_slot* slots;
+    uint32_t slot_count;
+
+    // Work distribution, guarded by the lock.
+    SDL_mutex* lock;
+    SDL_cond* cond;
+    uint32_t next_segment;      // The next segment to hand out to a worker.
+    uint32_t consumed;          // Number of segments handed to the sink so far.
+};
+
+// Render a segment into a slot.
+static void render_segment(struct replay* replay, struct nes* computer, uint32_t segment, struct replay_slot* slot)
+{
+    // Restore the keyframe at the start of the segment.
+    uint32_t frame = keyframes_seek(replay->keyframes, computer, segment * replay->segment_frames);
+    uint32_t end = min(frame + replay->segment_frames, replay->frame_count);
+
+    // Render each frame of the segment straight into the slot.
+    computer->render_skip = false;
+    for (struct agbr8888* pixels = slot->frames; frame < end; ++frame, pixels += NES_W * NES_H)
+    {
+        nes_setscreen(computer, pixels, NES_W * sizeof(struct agbr8888));
+        movie_input(replay->movie, frame, computer->controllers);
+        nes_frame(computer);
+    }
+}
+
+// Worker thread. Keeps claiming the next segment, waiting for its slot to be freed
+// up first, until every segment has been handed out.
+static int worker(void* userdata)
+{
+    struct replay* replay = userdata;
+    struct nes* computer = nes_alloc();
+    nes_setcartridge(computer, replay->cartridge);
+
+    SDL_LockMutex(replay->lock);
+    for (;;)
+    {
+        // Wait until the slot of the next segment has been consumed.
+        while (replay->next_segment < replay->segment_count
+            && replay->next_segment >= replay->consumed + replay->slot_count)
+            SDL_CondWait(replay->cond, replay->lock);
+        if (replay->next_segment >= replay->segment_count)
+            break;
+        uint32_t segment = replay->next_segment++;
+        struct replay_slot* slot = &replay->slots[segment % replay->slot_count];
+
+        // Render the segment without holding the lock.
+        SDL_UnlockMutex(replay->lock);
+        render_segment(replay, computer, segment, slot);
+        SDL_LockMutex(replay->lock);
+        slot->done = true;
+        SDL_CondBroadcast(replay->cond);
+    }
+    SDL_UnlockMutex(replay->lock);
+
+    // Exit.
+    nes_free(computer);
+    return 0;
+}
+
+// Render the frames of a movie.
+bool replay_render(struct nes* computer, struct movie* movie, uint32_t frame_count,
+    uint32_t segment_frames, unsigned threads, replay_sink sink, void* userdata)
+{
+    // Set up the replay.
+    struct replay replay;
+    memset(&replay, 0, sizeof(replay));
+    replay.cartridge = computer->cartridge;
+    replay.movie = movie;
+    replay.frame_count = frame_count;
+    replay.segment_frames = segment_frames;
+    replay.segment_count = (frame_count + segment_frames - 1) / segment_frames;
+    if (threads == 0)
+        threads = max(SDL_GetCPUCount(), 1);
+    threads = min(threads, max(replay.segment_count, 1));
+
+    // First pass: run through the movie with rendering skipped, capturing a keyframe
+    // at the start of every segment.
+    assert(frame_count <= movie->frame_count);
+    replay.keyframes = keyframes_alloc(movie->rom_crc32, movie_crc32(movie), segment_frames);
+    for (uint32_t frame = 0; frame < frame_count; frame += segment_frames)
+    {
+        keyframes_capture(replay.keyframes, computer, frame);
+        nes_run_frames(computer, movie->inputs + (size_t)frame * 2, min(segment_frames, frame_count - frame),
+            NES_RUN_NO_VIDEO);
+    }
+
+    // Allocate the segment buffers. A couple of spares let the workers carry on with
+    // later segments while the calling thread is still consuming the oldest one.
+    replay.slot_count = min(threads + 2, max(replay.segment_count, 1));
+    size_t slot_size = (size_t)min(segment_frames, frame_count) * NES_W * NES_H * sizeof(struct agbr8888);
+    replay.slots = safe_calloc(replay.slot_count, sizeof(struct replay_slot));
+    for (uint32_t i = 0; i < replay.slot_count; ++i)
+        replay.slots[i].frames = safe_malloc(max(slot_size, 1));
+    replay.lock = SDL_CreateMutex();
+    replay.cond = SDL_CreateCond();
+
+    // Second pass: start the workers. Carry on with however many could be started.
+    SDL_Thread** workers = safe_calloc(threads, sizeof(SDL_Thread*));
+    unsigned started = 0;
+    bool success = false;
+    if (replay.lock && replay.cond)
+    {
+        for (unsigned i = 0; i < threads; ++i)
+        {
+            if ((workers[started] = SDL_CreateThread(worker, "replay", &replay)) != NULL)
+                started++;
+        }
+    }
+    if (started == 0 && replay.segment_count)
+    {
+        snprintf(error_msg, sizeof(error_msg), "could not start the worker threads: %s", SDL_GetError());
+        goto cleanup;
+    }
+
+    // Hand the segments to the sink in order as they complete.
+    for (uint32_t segment = 0; segment < replay.segment_count; ++segment)
+    {
+        // Wait for the segment to be rendered.
+        struct replay_slot* slot = &replay.slots[segment % replay.slot_count];
+        SDL_LockMutex(replay.lock);
+        while (!slot->done)
+            SDL_CondWait(replay.cond, replay.lock);
+        SDL_UnlockMutex(replay.lock);
+
+        // Consume its frames.
+        uint32_t first = segment * segment_frames;
+        uint32_t count = min(segment_frames, frame_count - first);
+        for (uint32_t i = 0; i < count; ++i)
+            sink(userdata, first + i, slot->frames + (size_t)i * NES_W * NES_H);
+
+        // Free up the slot for a later segment.
+        SDL_LockMutex(replay.lock);
+        slot->done = false;
+        replay.consumed++;
+        SDL_CondBroadcast(replay.cond);
+        SDL_UnlockMutex(replay.lock);
+    }
+
+    success = true;
+
+    // Clean up.
+cleanup:
+    for (unsigned i = 0; i < started; ++i)
+        SDL_WaitThread(workers[i], NULL);
+    free(workers);
+    for (uint32_t i = 0; i < replay.slot_count; ++i)
+        free(replay.slots[i].frames);
+    free(replay.slots);
+    SDL_DestroyCond(replay.cond);
+    SDL_DestroyMutex(replay.lock);
+    keyframes_free(replay.keyframes);
+    return success;
+}
+
+// Get the replay error message.
+const char* replay_error_msg()
+{
+    return error_msg;
+}
\ No newline at end of file
@@ -0,0 +1,30 @@
+/*
+; Parallel replay rendering: renders every frame of an input movie by splitting it
+; into segments that are emulated side by side on worker threads.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "nes.h"
+#include "movie.h"
+
+// Default number of frames per segment (1 second). Each segment in flight holds
+// this many frames of pixels, so this also bounds the memory used.
+#define REPLAY_SEGMENT_FRAMES   60
+
+// Receives each rendered frame, in frame order, on the calling thread. The pixels
+// hold NES_H rows of NES_W pixels, and are only valid until the function returns.
+typedef void (*replay_sink)(void* userdata, uint32_t frame, const struct agbr8888* pixels);
+
+// Render frames [0, frame_count) of a movie, which must be at least that long. The
+// computer must be at power-on with its cartridge inserted; it is left at the end of
+// the movie. threads is the number of worker threads to use (0: one per CPU).
+// Returns false on failure; see replay_error_msg().
+bool replay_render(struct nes* computer, struct movie* movie, uint32_t frame_count,
+    uint32_t segment_frames, unsigned threads, replay_sink sink, void* userdata);
+
+// Get the replay error message.
+const char* replay_error_msg();
\ No newline at end of file
@@ -0,0 +1,215 @@
+/*
+; Snapshot store.
+;
+; Each page is hashed as it is put, and looked up by its hash (then compared in full,
+; so that a hash collision can never corrupt a snapshot). A page already stored just
+; gains a reference; only pages not seen before take up memory. Getting a snapshot
+; copies its pages back out in order, the last one cut short to the state size.
+*/
+
+#include <memory.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <assert.h>
+
+#include "util.h"
+#include "snapshot.h"
+
+// Find a page holding the given data, or add one, and take a reference to it.
+static uint32_t put_page(struct snapshot_store* store, const uint8_t* data)
+{
+    // Look for the page.
+    uint64_t hash = hash64(0, data, SNAPSHOT_PAGE_SIZE);
+    uint32_t* bucket = &store->buckets[hash & (store->bucket_count - 1)];
+    for (uint32_t index = *bucket; index != SNAPSHOT_NONE; index = store->pages[index].next)
+    {
+        struct snapshot_page* page = &store->pages[index];
+        if (page->hash == hash && !memcmp(page->data, data, SNAPSHOT_PAGE_SIZE))
+        {
+            page->refs++;
+            return index;
+        }
+    }
+
+    // Not found: take a free page, growing the page buffer if there are none.
+    uint32_t index = store->free_page;
+    if (index != SNAPSHOT_NONE)
+        store->free_page = store->pages[index].next;
+    else
+    {
+        if (store->page_count == store->page_capacity)
+        {
+            store->page_capacity = store->page_capacity ? store->page_capacity * 2 : 16;
+            struct snapshot_page* pages = safe_calloc(store->page_capacity, sizeof(struct snapshot_page));
+            memcpy(pages, store->pages, store->page_count * sizeof(struct snapshot_page));
+            free(store->pages);
+            store->pages = pages;
+        }
+        index = store->page_count++;
+    }
+
+    // Fill it in and add it to its bucket.
+    struct snapshot_page* page = &store->pages[index];
+    page->hash = hash;
+    page->refs = 1;
+    page->next = *bucket;
+    memcpy(page->data, data, SNAPSHOT_PAGE_SIZE);
+    *bucket = index;
+    store->live_pages++;
+
+    // Keep the buckets at least as many as the pages, rehashing as they double.
+    if (store->live_pages > store->bucket_count)
+    {
+        free(store->buckets);
+        store->bucket_count *= 2;
+        store->buckets = safe_calloc(store->bucket_count, sizeof(uint32_t));
+        memset(store->buckets, 0xFF, store->bucket_count * sizeof(uint32_t));
+        for (uint32_t i = 0; i < store->page_count; ++i)
+        {
+            if (store->pages[i].refs == 0)
+                continue;
+            bucket = &store->buckets[store->pages[i].hash & (store->bucket_count - 1)];
+            store->pages[i].next = *bucket;
+            *bucket = i;
+        }
+    }
+    return index;
+}
+
+// Drop a reference to a page, freeing it once there are none left.
+static void drop_page(struct snapshot_store* store, uint32_t index)
+{
+    struct snapshot_page* page = &store->pages[index];
+    assert(page->refs);
+    if (--page->refs)
+        return;
+
+    // Unlink it from its bucket, then add it to the free list.
+    uint32_t* link = &store->buckets[page->hash & (store->bucket_count - 1)];
+    while (*link != index)
+        link = &store->pages[*link].next;
+    *link = page->next;
+    page->next = store->free_page;
+    store->free_page = index;
+    store->live_pages--;
+}
+
+// Store a state buffer.
+uint32_t snapshot_put(struct snapshot_store* store, const void* state)
+{
+    // Take a free snapshot, growing the snapshot buffer if there are none.
+    uint32_t id = store->free_snapshot;
+    if (id != SNAPSHOT_NONE)
+        store->free_snapshot = store->snapshots[(size_t)id * store->state_pages];
+    else
+    {
+        if (store->snapshot_count == store->snapshot_capacity)
+        {
+            store->snapshot_capacity = store->snapshot_capacity ? store->snapshot_capacity * 2 : 64;
+            uint32_t* snapshots = safe_calloc(store->snapshot_capacity, store->state_pages * sizeof(uint32_t));
+            memcpy(snapshots, store->snapshots, (size_t)store->snapshot_count * store->state_pages * sizeof(uint32_t));
+            free(store->snapshots);
+            store->snapshots = snapshots;
+        }
+        id = store->snapshot_count++;
+    }
+    store->live_snapshots++;
+
+    // Store each page. The last one is padded out with zeroes.
+    uint32_t* indices = &store->snapshots[(size_t)id * store->state_pages];
+    const uint8_t* bytes = state;
+    for (uint32_t i = 0; i < store->state_pages; ++i)
+    {
+        size_t offset = (size_t)i * SNAPSHOT_PAGE_SIZE;
+        if (offset + SNAPSHOT_PAGE_SIZE <= store->state_size)
+            indices[i] = put_page(store, bytes + offset);
+        else
+        {
+            uint8_t last[SNAPSHOT_PAGE_SIZE];
+            memset(last, 0, sizeof(last));
+            memcpy(last, bytes + offset, store->state_size - offset);
+            indices[i] = put_page(store, last);
+        }
+    }
+    return id;
+}
+
+// Rebuild a snapshot into a state buffer.
+void snapshot_get(const struct snapshot_store* store, uint32_t id, void* state)
+{
+    assert(id < store->snapshot_count);
+    const uint32_t* indices = &store->snapshots[(size_t)id * store->state_pages];
+    uint8_t* bytes = state;
+    for (uint32_t i = 0; i < store->state_pages; ++i)
+    {
+        size_t offset = (size_t)i * SNAPSHOT_PAGE_SIZE;
+        memcpy(bytes + offset, store->pages[indices[i]].data, min(SNAPSHOT_PAGE_SIZE, store->state_size - offset));
+    }
+}
+
+// Drop a snapshot.
+void snapshot_drop(struct snapshot_store* store, uint32_t id)
+{
+    assert(id < store->snapshot_count);
+    uint32_t* indices = &store->snapshots[(size_t)id * store->state_pages];
+    for (uint32_t i = 0; i < store->state_pages; ++i)
+        drop_page(store, indices[i]);
+    indices[0] = store->free_snapshot;
+    store->free_snapshot = id;
+    store->live_snapshots--;
+}
+
+// Store the state of a NES.
+uint32_t snapshot_save(struct snapshot_store* store, struct nes* computer)
+{
+    assert(store->state_size == NES_STATE_SIZE);
+    uint8_t state[NES_STATE_SIZE];
+    nes_state_save(computer, state);
+    return snapshot_put(store, state);
+}
+
+// Restore the state of a NES from a snapshot.
+void snapshot_restore(const struct snapshot_store* store, uint32_t id, struct nes* computer)
+{
+    assert(store->state_size == NES_STATE_SIZE);
+    uint8_t state[NES_STATE_SIZE];
+    snapshot_get(store, id, state);
+    nes_state_load(computer, state);
+}
+
+// Report the memory used by the store.
+void snapshot_store_report(const struct snapshot_store* store, struct snapshot_report* report)
+{
+    memset(report, 0, sizeof(struct snapshot_report));
+    report->snapshots = store->live_snapshots;
+    report->pages = store->live_pages;
+    report->logical = (size_t)store->live_snapshots * store->state_size;
+    report->stored = sizeof(struct snapshot_store) + store->page_capacity * sizeof(struct snapshot_page)
+        + store->bucket_count * sizeof(uint32_t) + (size_t)store->snapshot_capacity * store->state_pages * sizeof(uint32_t);
+}
+
+// Create a new, empty snapshot store.
+struct snapshot_store* snapshot_store_alloc(size_t state_size)
+{
+    assert(state_size);
+    struct snapshot_store* store = safe_malloc(sizeof(struct snapshot_store));
+    store->state_size = state_size;
+    store->state_pages = (uint32_t)((state_size + SNAPSHOT_PAGE_SIZE - 1) / SNAPSHOT_PAGE_SIZE);
+    store->free_page = SNAPSHOT_NONE;
+    store->free_snapshot = SNAPSHOT_NONE;
+    store->bucket_count = 64;
+    store->buckets = safe_calloc(store->bucket_count, sizeof(uint32_t));
+    memset(store->buckets, 0xFF, store->bucket_count * sizeof(uint32_t));
+    return store;
+}
+
+// Free a snapshot store.
+void snapshot_store_free(struct snapshot_store* store)
+{
+    if (store == NULL)
+        return;
+    free(store->pages);
+    free(store->buckets);
+    free(store->snapshots);
+    free(store);
+}
\ No newline at end of file
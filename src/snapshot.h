@@ -0,0 +1,88 @@
+/*
+; Snapshot store: holds many save states at once, split into fixed-size pages that
+; are stored once however many snapshots share them. Snapshots taken along a search
+; tree or a rewind buffer mostly repeat each other page for page, so this holds far
+; more of them in the same memory than keeping each one whole.
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "nes.h"
+
+// Size of the pages that snapshots are split into.
+#define SNAPSHOT_PAGE_SIZE      0x100
+
+// Marks the end of a page chain or free list.
+#define SNAPSHOT_NONE           0xFFFFFFFF
+
+// A stored page, shared by every snapshot holding the same data.
+struct snapshot_page
+{
+    uint64_t hash;              // hash64() of the data.
+    uint32_t refs;              // Number of snapshot pages pointing here (0: free).
+    uint32_t next;              // Next page in the same hash bucket, or in the free list.
+    uint8_t data[SNAPSHOT_PAGE_SIZE];
+};
+
+// Snapshot store struct definition.
+struct snapshot_store
+{
+    size_t state_size;          // Size of each snapshot.
+    uint32_t state_pages;       // Number of pages each snapshot is split into.
+
+    // Pages, found by content through a chained hash table.
+    struct snapshot_page* pages;
+    uint32_t page_count;        // Number of pages allocated, in use or free.
+    uint32_t page_capacity;
+    uint32_t free_page;         // First free page (SNAPSHOT_NONE: none).
+    uint32_t live_pages;
+    uint32_t* buckets;          // First page of each bucket; a power of two of them.
+    uint32_t bucket_count;
+
+    // Snapshots, each a list of state_pages page indices. A freed snapshot holds
+    // the index of the next free one in its first entry.
+    uint32_t* snapshots;
+    uint32_t snapshot_count;    // Number of snapshots allocated, in use or free.
+    uint32_t snapshot_capacity;
+    uint32_t free_snapshot;     // First free snapshot (SNAPSHOT_NONE: none).
+    uint32_t live_snapshots;
+};
+
+// Memory used by a snapshot store, in bytes.
+struct snapshot_report
+{
+    uint32_t snapshots;         // Number of snapshots held.
+    uint32_t pages;             // Number of distinct pages stored.
+    size_t logical;             // Size of the snapshots if each were held whole.
+    size_t stored;              // Memory actually taken up by the store.
+};
+
+// Store a state buffer of state_size bytes, returning the snapshot's ID.
+uint32_t snapshot_put(struct snapshot_store* store, const void* state);
+
+// Rebuild a snapshot into a state buffer of state_size bytes. Several threads can get
+// snapshots at once, as long as none is putting or dropping any.
+void snapshot_get(const struct snapshot_store* store, uint32_t id, void* state);
+
+// Drop a snapshot, freeing any pages no other snapshot holds. The ID may be reused.
+void snapshot_drop(struct snapshot_store* store, uint32_t id);
+
+// Store the state of a NES (see nes_state_save()), returning the snapshot's ID.
+uint32_t snapshot_save(struct snapshot_store* store, struct nes* computer);
+
+// Restore the state of a NES from a snapshot (see nes_state_load()).
+void snapshot_restore(const struct snapshot_store* store, uint32_t id, struct nes* computer);
+
+// Report the memory used by the store.
+void snapshot_store_report(const struct snapshot_store* store, struct snapshot_report* report);
+
+// Create a new, empty snapshot store for states of the given size (nes_state_size()
+// for NES states).
+struct snapshot_store* snapshot_store_alloc(size_t state_size);
+
+// Free a snapshot store, along with every snapshot in it.
+void snapshot_store_free(struct snapshot_store* store);
\ No newline at end of file
@@ -0,0 +1,87 @@
+/*
+; Visited-state set.
+;
+; A hash is added by claiming the first empty slot along its probe sequence with a
+; compare-and-swap. Slots are only ever filled, never emptied, so a thread that loses
+; the race for a slot only has to check what the winner put there and move on. The
+; table is kept at most three quarters full, which keeps the probe sequences short.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <assert.h>
+
+#include "util.h"
+#include "state_set.h"
+
+// Add a state hash to the set.
+bool state_set_insert(struct state_set* set, uint64_t hash)
+{
+    hash = hash ? hash : 1;
+    uint32_t mask = set->capacity - 1;
+    for (uint32_t i = (uint32_t)hash & mask;; i = (i + 1) & mask)
+    {
+        // Found it, or found where it would be.
+        uint64_t slot = atomic_load_u64(&set->slots[i]);
+        if (slot == hash)
+            return false;
+        if (slot != 0)
+            continue;
+
+        // Reserve room for it; once the set is full, stop adding.
+        if (atomic_add_u32(&set->count, 1) >= set->limit)
+        {
+            atomic_add_u32(&set->count, (uint32_t)-1);
+            return true;
+        }
+
+        // Claim the slot. If another thread got there first, give the room back and
+        // check what it put there.
+        slot = atomic_cas_u64(&set->slots[i], 0, hash);
+        if (slot == 0)
+            return true;
+        atomic_add_u32(&set->count, (uint32_t)-1);
+        if (slot == hash)
+            return false;
+    }
+}
+
+// Check whether a state hash is in the set.
+bool state_set_contains(struct state_set* set, uint64_t hash)
+{
+    hash = hash ? hash : 1;
+    uint32_t mask = set->capacity - 1;
+    for (uint32_t i = (uint32_t)hash & mask;; i = (i + 1) & mask)
+    {
+        uint64_t slot = atomic_load_u64(&set->slots[i]);
+        if (slot == hash)
+            return true;
+        if (slot == 0)
+            return false;
+    }
+}
+
+// Create a new state set.
+struct state_set* state_set_alloc(uint32_t hashes)
+{
+    // Size the table so that it is at most three quarters full.
+    assert(hashes && hashes <= 0x60000000);
+    uint32_t capacity = 4;
+    while (capacity / 4 * 3 < hashes)
+        capacity <<= 1;
+    struct state_set* set = safe_malloc(sizeof(struct state_set));
+    set->capacity = capacity;
+    set->limit = capacity / 4 * 3;
+    set->count = 0;
+    set->slots = safe_calloc(capacity, sizeof(uint64_t));
+    return set;
+}
+
+// Free a state set.
+void state_set_free(struct state_set* set)
+{
+    if (set == NULL)
+        return;
+    free((void*)set->slots);
+    free(set);
+}
\ No newline at end of file
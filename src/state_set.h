@@ -0,0 +1,34 @@
+/*
+; Visited-state set: a fixed-size set of state hashes (see nes_hash()) that any number
+; of threads can insert into at once without taking a lock, so that a search can tell
+; when it reaches a state it has already been to.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// State set struct definition. The slots are an open-addressed table, probed linearly;
+// an empty slot holds 0, which is why a hash of 0 is stored as 1.
+struct state_set
+{
+    uint32_t capacity;          // Number of slots; a power of two.
+    uint32_t limit;             // Number of hashes held before the set counts as full.
+    volatile uint32_t count;    // Number of hashes held.
+    volatile uint64_t* slots;
+};
+
+// Add a state hash to the set. Returns true if it wasn't there before. Once the set
+// is full, hashes that aren't there are no longer added, but still count as new, so
+// that a full set never has a search pass over a state it hasn't seen.
+bool state_set_insert(struct state_set* set, uint64_t hash);
+
+// Check whether a state hash is in the set.
+bool state_set_contains(struct state_set* set, uint64_t hash);
+
+// Create a new state set for up to the given number of hashes.
+struct state_set* state_set_alloc(uint32_t hashes);
+
+// Free a state set.
+void state_set_free(struct state_set* set);
\ No newline at end of file
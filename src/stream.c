@@ -0,0 +1,164 @@
+/*
+; Frame stream.
+;
+; Each slot is guarded by its own sequence counter, seqlock style: marked odd before
+; the PPU starts rendering into it, and even again, with the frame's count folded in,
+; once the frame is published. The header's count of frames published is bumped last,
+; so a reader that finds the slot it points at with the matching sequence knows the
+; frame is whole.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <memory.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "util.h"
+#include "nes.h"
+#include "stream.h"
+
+#if defined(_WIN32)
+#include <Windows.h>
+#elif defined(POSIX)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+// Everything in the region is kept on its own cache lines.
+#define STREAM_ALIGN            64
+#define STREAM_ALIGN_UP(n)      (((n) + STREAM_ALIGN - 1) & ~(size_t)(STREAM_ALIGN - 1))
+
+// Internal error message buffer.
+static char error_msg[128];
+
+// Get a slot of the stream.
+static struct stream_slot* get_slot(struct stream* stream, uint64_t index)
+{
+    struct stream_header* header = stream->header;
+    return (struct stream_slot*)(stream->region + header->slots_offset
+        + (size_t)(index % header->slot_count) * header->slot_size);
+}
+
+// Start writing the next frame into the stream.
+void* stream_begin(struct stream* stream, size_t* pitch)
+{
+    // Mark the slot as being written before the PPU touches it.
+    uint64_t index = stream->header->published;
+    struct stream_slot* slot = get_slot(stream, index);
+    atomic_store_u64(&slot->sequence, index * 2 + 1);
+    atomic_fence();
+    *pitch = stream->header->pitch;
+    return (uint8_t*)slot + stream->header->pixels_offset;
+}
+
+// Publish the frame begun with stream_begin().
+void stream_publish(struct stream* stream, uint64_t frame, const union controller* controllers, const uint8_t* ram)
+{
+    uint64_t index = stream->header->published;
+    struct stream_slot* slot = get_slot(stream, index);
+    slot->frame = frame;
+    slot->input[0] = controllers[0].value;
+    slot->input[1] = controllers[1].value;
+    memcpy(slot->ram, ram, sizeof(slot->ram));
+    atomic_store_u64(&slot->sequence, index * 2 + 2);
+    atomic_store_u64(&stream->header->published, index + 1);
+}
+
+// Create a frame stream.
+struct stream* stream_alloc(const char* name, uint32_t slot_count)
+{
+    if (name[0] == '\0' || strlen(name) + 2 > sizeof(((struct stream*)NULL)->name) || slot_count == 0)
+    {
+        snprintf(error_msg, sizeof(error_msg), "a stream needs a name of 1-62 characters and at least one slot");
+        return NULL;
+    }
+
+    // Lay out the region: the header, then the slots, each its metadata then pixels.
+    size_t pixels_offset = STREAM_ALIGN_UP(sizeof(struct stream_slot));
+    size_t pitch = NES_W * sizeof(struct agbr8888);
+    size_t slot_size = STREAM_ALIGN_UP(pixels_offset + pitch * NES_H);
+    size_t slots_offset = STREAM_ALIGN_UP(sizeof(struct stream_header));
+    size_t size = slots_offset + slot_size * slot_count;
+    struct stream* stream = safe_malloc(sizeof(struct stream));
+    stream->size = size;
+
+    // Create the region and map it. POSIX shared memory names start with a slash.
+#if defined(_WIN32)
+    snprintf(stream->name, sizeof(stream->name), "%s", name);
+    stream->mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, (DWORD)((uint64_t)size >> 32),
+        (DWORD)size, stream->name);
+    if (stream->mapping == NULL || GetLastError() == ERROR_ALREADY_EXISTS
+        || (stream->region = MapViewOfFile(stream->mapping, FILE_MAP_ALL_ACCESS, 0, 0, size)) == NULL)
+    {
+        snprintf(error_msg, sizeof(error_msg), "could not create shared memory %s", stream->name);
+        goto fail;
+    }
+#elif defined(POSIX)
+    snprintf(stream->name, sizeof(stream->name), "%s%s", name[0] == '/' ? "" : "/", name);
+    int file = shm_open(stream->name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (file < 0)
+    {
+        snprintf(error_msg, sizeof(error_msg), "could not create shared memory %s", stream->name);
+        goto fail;
+    }
+    void* region = MAP_FAILED;
+    if (ftruncate(file, (off_t)size) == 0)
+        region = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+    close(file);
+    if (region == MAP_FAILED)
+    {
+        snprintf(error_msg, sizeof(error_msg), "could not map shared memory %s", stream->name);
+        shm_unlink(stream->name);
+        goto fail;
+    }
+    stream->region = region;
+#else
+    snprintf(error_msg, sizeof(error_msg), "shared memory is not supported on this platform");
+    goto fail;
+#endif
+
+    // Fill in the header. The region starts out zeroed, so no frame is published yet.
+    struct stream_header* header = stream->header = (struct stream_header*)stream->region;
+    header->version = STREAM_VERSION;
+    header->slot_count = slot_count;
+    header->slot_size = (uint32_t)slot_size;
+    header->slots_offset = (uint32_t)slots_offset;
+    header->pixels_offset = (uint32_t)pixels_offset;
+    header->width = NES_W;
+    header->height = NES_H;
+    header->pitch = (uint32_t)pitch;
+    atomic_fence();
+    memcpy(header->magic, STREAM_MAGIC, sizeof(STREAM_MAGIC));
+    return stream;
+
+fail:
+#if defined(_WIN32)
+    if (stream->mapping)
+        CloseHandle(stream->mapping);
+#endif
+    free(stream);
+    return NULL;
+}
+
+// Free a frame stream.
+void stream_free(struct stream* stream)
+{
+    if (stream == NULL)
+        return;
+#if defined(_WIN32)
+    UnmapViewOfFile(stream->region);
+    CloseHandle(stream->mapping);
+#elif defined(POSIX)
+    munmap(stream->region, stream->size);
+    shm_unlink(stream->name);
+#endif
+    free(stream);
+}
+
+// Get the last error message.
+const char* stream_error_msg()
+{
+    return error_msg;
+}
\ No newline at end of file
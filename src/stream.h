@@ -0,0 +1,85 @@
+/*
+; Frame stream: publishes every frame, with its number, input and RAM, to a ring of
+; slots in a named shared-memory region, for other processes (recorders, dashboards,
+; agents) to map and read without ever talking to the emulator. The PPU renders
+; straight into the slot being written, so a frame is never copied on either side.
+;
+; Readers take the latest frame like so, retrying from the top if a check fails:
+; 1. Load published (acquire). 0 means no frame yet; otherwise the frame is number
+;    published - 1, in slot (published - 1) % slot_count.
+; 2. Load the slot's sequence (acquire). It must be 2 * published.
+; 3. Read what is needed from the slot, then load the sequence again after a fence.
+;    If it is unchanged, what was read is whole; otherwise the writer came around to
+;    the slot in the meantime.
+; The writer only comes back to a slot slot_count frames later, so with a few slots a
+; reader keeping up with the frame rate never has to retry.
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "nes.h"
+
+// Region format.
+#define STREAM_MAGIC            "NESSTRM"
+#define STREAM_VERSION          1
+
+// Region header, at offset 0.
+struct stream_header
+{
+    char magic[8];              // STREAM_MAGIC, NUL-terminated.
+    uint32_t version;           // STREAM_VERSION.
+    uint32_t slot_count;
+    uint32_t slot_size;         // Bytes from the start of one slot to the next.
+    uint32_t slots_offset;      // Offset of the first slot in the region.
+    uint32_t pixels_offset;     // Offset of the pixels within a slot.
+    uint32_t width;             // Pixels per row, 4 bytes each: R, G, B, A.
+    uint32_t height;            // Rows.
+    uint32_t pitch;             // Bytes from one row to the next.
+    volatile uint64_t published;// Number of frames published.
+};
+
+// Slot metadata, followed by the pixels at pixels_offset.
+struct stream_slot
+{
+    volatile uint64_t sequence; // 2n + 1 while the nth frame published (from 0) is
+                                // being written into the slot, 2n + 2 once it's done.
+    uint64_t frame;             // Frame number, as the frontend counts it.
+    uint8_t input[2];           // Controller ports 0 and 1.
+    uint8_t padding[6];
+    uint8_t ram[0x800];
+};
+
+// Frame stream struct definition.
+struct stream
+{
+    char name[64];
+    uint8_t* region;
+    size_t size;
+    struct stream_header* header;
+#if defined(_WIN32)
+    void* mapping;              // Keeps the region's name around until it is freed.
+#endif
+};
+
+// Start writing the next frame into the stream, returning the pixels of its slot for
+// the PPU to render into, and their pitch.
+void* stream_begin(struct stream* stream, size_t* pitch);
+
+// Publish the frame begun with stream_begin(), along with its number, input and RAM.
+void stream_publish(struct stream* stream, uint64_t frame, const union controller* controllers, const uint8_t* ram);
+
+// Create a frame stream of slot_count slots in a new shared-memory region of the
+// given name (POSIX: shm_open(); Windows: a named file mapping). Returns NULL on
+// failure; see stream_error_msg().
+struct stream* stream_alloc(const char* name, uint32_t slot_count);
+
+// Free a frame stream, removing the region's name. Readers that have it mapped keep
+// it until they unmap it.
+void stream_free(struct stream* stream);
+
+// Get the last error message.
+const char* stream_error_msg();
\ No newline at end of file
@@ -0,0 +1,36 @@
+/*
+; Trace formatter: prints a CPU trace saved by nesemu (see trace.h) as nestest-style
+; text, oldest instruction first.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "trace.h"
+#include "cpu.h"
+
+int main(int argc, char** argv)
+{
+    if (argc < 2 || argc > 3)
+    {
+        puts("usage: nestrace trace.ntr [last n instructions]");
+        return EXIT_FAILURE;
+    }
+
+    // Load the trace.
+    struct trace* trace = trace_load(argv[1]);
+    if (trace == NULL)
+    {
+        fprintf(stderr, "trace is corrupt: %s\n", trace_error_msg());
+        return EXIT_FAILURE;
+    }
+
+    // Print the records asked for.
+    uint32_t size = trace_size(trace);
+    uint32_t count = argc == 3 ? strtoul(argv[2], NULL, 0) : size;
+    for (uint32_t i = count < size ? size - count : 0; i < size; ++i)
+        cpu_spew(trace_get(trace, i), stdout);
+    trace_free(trace);
+    return EXIT_SUCCESS;
+}
\ No newline at end of file
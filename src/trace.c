@@ -0,0 +1,125 @@
+/*
+; CPU trace.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <assert.h>
+
+#include "util.h"
+#include "trace.h"
+
+#define TRACE_MAGIC         0x1A52544E  // "NTR\x1A"
+
+// Internal error message buffer.
+static char error_msg[128];
+
+// Trace file format header.
+struct trace_header
+{
+    int32_t magic;              // "NTR\x1A"; see TRACE_MAGIC macro
+    uint32_t record_size;       // size of each record; must match sizeof(struct trace_record)
+    uint32_t count;             // number of records that follow, oldest first
+};
+
+// Save the records held to a file.
+bool trace_save(const struct trace* trace, const char* path)
+{
+    FILE* file = fopen(path, "wb");
+    if (file == NULL)
+        return false;
+    uint32_t size = trace_size(trace);
+    struct trace_header header =
+    {
+        .magic = TRACE_MAGIC,
+        .record_size = sizeof(struct trace_record),
+        .count = size
+    };
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1;
+
+    // The ring wraps around at most once, so the records go out in two runs.
+    uint32_t start = (uint32_t)((trace->count - size) & (trace->capacity - 1));
+    uint32_t first = min(size, trace->capacity - start);
+    written = written && fwrite(&trace->records[start], sizeof(struct trace_record), first, file) == first
+        && fwrite(trace->records, sizeof(struct trace_record), size - first, file) == size - first;
+    return (fclose(file) == 0) && written;
+}
+
+// Load a trace from a file.
+struct trace* trace_load(const char* path)
+{
+    // Read the header.
+    FILE* file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        snprintf(error_msg, sizeof(error_msg), "could not open %s", path);
+        return NULL;
+    }
+    struct trace_header header;
+    if (fread(&header, sizeof(header), 1, file) != 1)
+    {
+        snprintf(error_msg, sizeof(error_msg), "trace header size too small");
+        goto corrupt;
+    }
+
+    // Validate the header.
+    if (header.magic != TRACE_MAGIC)
+    {
+        snprintf(error_msg, sizeof(error_msg), "incorrect magic");
+        goto corrupt;
+    }
+    if (header.record_size != sizeof(struct trace_record))
+    {
+        snprintf(error_msg, sizeof(error_msg), "record size $%X does not match this build ($%zX)",
+            header.record_size, sizeof(struct trace_record));
+        goto corrupt;
+    }
+
+    // Read the records.
+    struct trace* trace = trace_alloc(header.count ? header.count : 1);
+    uint32_t count = (uint32_t)fread(trace->records, sizeof(struct trace_record), header.count, file);
+    if (count != header.count)
+    {
+        snprintf(error_msg, sizeof(error_msg), "expected %u records, got %u", header.count, count);
+        trace_free(trace);
+        goto corrupt;
+    }
+    trace->count = count;
+    fclose(file);
+    return trace;
+
+corrupt:
+    fclose(file);
+    return NULL;
+}
+
+// Create a new, empty trace.
+struct trace* trace_alloc(uint32_t records)
+{
+    assert(records && records <= 0x80000000);
+    uint32_t capacity = 1;
+    while (capacity < records)
+        capacity <<= 1;
+    struct trace* trace = safe_malloc(sizeof(struct trace));
+    trace->capacity = capacity;
+    trace->count = 0;
+    trace->records = safe_malloc(capacity * sizeof(struct trace_record));
+    return trace;
+}
+
+// Free a trace.
+void trace_free(struct trace* trace)
+{
+    if (trace == NULL)
+        return;
+    free(trace->records);
+    free(trace);
+}
+
+// Get the trace error message.
+const char* trace_error_msg()
+{
+    return error_msg;
+}
\ No newline at end of file
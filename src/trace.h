@@ -0,0 +1,79 @@
+/*
+; CPU trace: a fixed-size ring of packed binary records, one per instruction executed,
+; holding the last instructions run. Capturing a record never touches the bus, so a
+; trace can be left running; it is formatted offline (see cpu_spew() and the nestrace
+; tool).
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Default number of records kept.
+#define TRACE_DEFAULT_RECORDS   (1 << 16)
+
+// Trace record, captured as an instruction is about to execute.
+struct trace_record
+{
+    uint64_t cycle;             // CPU cycles executed since power-on.
+    uint16_t pc;
+    uint8_t opcode;
+    uint8_t operands[2];        // The bytes after the opcode; only as many as the
+                                // addressing mode uses are meaningful.
+    uint8_t a;
+    uint8_t x;
+    uint8_t y;
+    uint8_t p;
+    uint8_t s;
+    int16_t scanline;           // PPU position.
+    int16_t dot;
+};
+
+// Trace struct definition.
+struct trace
+{
+    uint32_t capacity;          // Number of records; a power of two.
+    uint64_t count;             // Number of records captured in total.
+    struct trace_record* records;
+};
+
+// Claim the next record of the ring, overwriting the oldest one once it is full.
+inline struct trace_record* trace_next(struct trace* trace)
+{
+    return &trace->records[trace->count++ & (trace->capacity - 1)];
+}
+
+// Get the number of records held.
+inline uint32_t trace_size(const struct trace* trace)
+{
+    return trace->count < trace->capacity ? (uint32_t)trace->count : trace->capacity;
+}
+
+// Get a record held, counting from the oldest.
+inline const struct trace_record* trace_get(const struct trace* trace, uint32_t index)
+{
+    return &trace->records[(trace->count - trace_size(trace) + index) & (trace->capacity - 1)];
+}
+
+// Forget every record.
+inline void trace_clear(struct trace* trace)
+{
+    trace->count = 0;
+}
+
+// Save the records held, oldest first, to a file. Returns false on failure.
+bool trace_save(const struct trace* trace, const char* path);
+
+// Load a trace from a file. Returns NULL on failure; see trace_error_msg().
+struct trace* trace_load(const char* path);
+
+// Create a new, empty trace holding the given number of records, rounded up to a
+// power of two.
+struct trace* trace_alloc(uint32_t records);
+
+// Free a trace.
+void trace_free(struct trace* trace);
+
+// Get the trace error message.
+const char* trace_error_msg();
\ No newline at end of file
@@ -0,0 +1,40 @@
+/*
+; Lock-free triple buffer. One thread (the writer) publishes finished buffers, another
+; thread (the reader) picks up the most recently published one.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "util.h"
+#include "triple_buffer.h"
+
+// Initialize a triple buffer over three caller-owned buffers.
+void triple_buffer_init(struct triple_buffer* triple, void* a, void* b, void* c)
+{
+    triple->buffers[0] = a;
+    triple->buffers[1] = b;
+    triple->buffers[2] = c;
+    triple->back = 0;
+    triple->middle = 1;
+    triple->front = 2;
+}
+
+// Publish the back buffer and take over the middle one (writer only).
+void triple_buffer_publish(struct triple_buffer* triple)
+{
+    // If the reader never picked up the previous middle buffer, it is simply dropped
+    // and recycled as the new back buffer.
+    uint32_t previous = atomic_exchange_u32(&triple->middle, triple->back | TRIPLE_BUFFER_FRESH);
+    triple->back = previous & ~TRIPLE_BUFFER_FRESH;
+}
+
+// Swap in the most recently published buffer as the front buffer (reader only).
+bool triple_buffer_consume(struct triple_buffer* triple)
+{
+    if (!triple_buffer_fresh(triple))
+        return false;
+    uint32_t previous = atomic_exchange_u32(&triple->middle, triple->front);
+    triple->front = previous & ~TRIPLE_BUFFER_FRESH;
+    return true;
+}
\ No newline at end of file
@@ -0,0 +1,58 @@
+/*
+; Lock-free triple buffer. One thread (the writer) publishes finished buffers, another
+; thread (the reader) picks up the most recently published one. Neither side ever
+; blocks the other: the writer always has a buffer to write into, and the reader
+; always has a complete buffer to read from.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "util.h"
+
+// Set in the shared slot when it holds a buffer that the reader hasn't picked up yet.
+#define TRIPLE_BUFFER_FRESH 0x4
+
+// Triple buffer struct definition.
+struct triple_buffer
+{
+    // The three buffers.
+    void* buffers[3];
+
+    // Buffer indices. The writer owns the back buffer, the reader owns the front
+    // buffer, and the middle one is swapped between the two atomically.
+    uint32_t back;
+    uint32_t front;
+    volatile uint32_t middle;   // Index | TRIPLE_BUFFER_FRESH
+};
+
+// Initialize a triple buffer over three caller-owned buffers.
+void triple_buffer_init(struct triple_buffer* triple, void* a, void* b, void* c);
+
+// Return the buffer the writer should be writing into (writer only).
+inline void* triple_buffer_back(struct triple_buffer* triple)
+{
+    return triple->buffers[triple->back];
+}
+
+// Return the buffer the reader should be reading from (reader only).
+inline void* triple_buffer_front(struct triple_buffer* triple)
+{
+    return triple->buffers[triple->front];
+}
+
+// Publish the back buffer and take over the middle one (writer only).
+void triple_buffer_publish(struct triple_buffer* triple);
+
+// Return whether a buffer has been published since the reader last swapped one in
+// (reader only).
+inline bool triple_buffer_fresh(struct triple_buffer* triple)
+{
+    return (atomic_load_u32(&triple->middle) & TRIPLE_BUFFER_FRESH) != 0;
+}
+
+// Swap in the most recently published buffer as the front buffer (reader only).
+// Returns false if nothing new has been published since the last call.
+bool triple_buffer_consume(struct triple_buffer* triple);
\ No newline at end of file
@@ -5,21 +5,34 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <memory.h>
 #include <assert.h>
 
 #include "util.h"
 
+// How long before the deadline sleep_until_ns() stops sleeping and starts spinning.
+// Windows timers are far coarser than POSIX ones, so leave more slack there.
+#if defined(_WIN32)
+#define SPIN_THRESHOLD (NANOSECOND / 500)   // 2ms
+#else
+#define SPIN_THRESHOLD (NANOSECOND / 2000)  // 0.5ms
+#endif
+
 #if defined (_WIN32)
 #include <Windows.h>
 #elif defined(POSIX)
 #include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #endif
 
 void* safe_calloc(size_t count, size_t size)
 {
     assert(count);
     assert(size);
-    void* ptr = calloc(1, size);
+    void* ptr = calloc(count, size);
     if (ptr == NULL)
     {
         fprintf(stderr, "*ERROR* MEMORY ALLOCATION FAILED!\n");
@@ -39,10 +52,234 @@ uint64_t get_ns_timestamp()
     return (counter.QuadPart * NANOSECOND) / frequency.QuadPart;
 #elif defined (POSIX)
     struct timespec timestamp;
-    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &timestamp);
+    clock_gettime(CLOCK_MONOTONIC, &timestamp);
     return timestamp.tv_sec * NANOSECOND + timestamp.tv_nsec;
 #endif
 
     fprintf(stderr, "get_ns_timestamp(): target platform is not supported\n");
     return 0;
+}
+
+uint32_t crc32(uint32_t crc, const void* data, size_t size)
+{
+    // Build the lookup table on first use.
+    static uint32_t table[256];
+    if (table[1] == 0)
+    {
+        for (uint32_t i = 0; i < 256; ++i)
+        {
+            uint32_t value = i;
+            for (int bit = 0; bit < 8; ++bit)
+                value = (value >> 1) ^ ((value & 1) ? 0xEDB88320 : 0);
+            table[i] = value;
+        }
+    }
+
+    // Checksum the buffer.
+    const uint8_t* bytes = data;
+    crc = ~crc;
+    for (size_t i = 0; i < size; ++i)
+        crc = table[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+// Run introducers (see run_encode()).
+#define RUN_COPY            0x00
+#define RUN_FILL            0x40
+#define RUN_LITERAL         0x80
+#define RUN_COPY_MAX        64
+#define RUN_FILL_MAX        64
+#define RUN_LITERAL_MAX     128
+
+// Mixing constants, from xxHash64.
+#define HASH64_PRIME1   0x9E3779B185EBCA87ULL
+#define HASH64_PRIME2   0xC2B2AE3D27D4EB4FULL
+#define HASH64_PRIME3   0x165667B19E3779F9ULL
+
+uint64_t hash64(uint64_t seed, const void* data, size_t size)
+{
+    // Mix in the buffer a word at a time, then whatever is left over a byte at a time.
+    const uint8_t* bytes = data;
+    uint64_t hash = seed + HASH64_PRIME3 + size;
+    for (; size >= 8; bytes += 8, size -= 8)
+    {
+        uint64_t word;
+        memcpy(&word, bytes, sizeof(word));
+        word *= HASH64_PRIME2;
+        hash ^= (word << 31 | word >> 33) * HASH64_PRIME1;
+        hash = (hash << 27 | hash >> 37) * HASH64_PRIME1 + HASH64_PRIME3;
+    }
+    for (; size; ++bytes, --size)
+    {
+        hash ^= *bytes * HASH64_PRIME3;
+        hash = (hash << 11 | hash >> 53) * HASH64_PRIME1;
+    }
+
+    // Avalanche, so that every bit of the input affects every bit of the hash.
+    hash ^= hash >> 33;
+    hash *= HASH64_PRIME2;
+    hash ^= hash >> 29;
+    hash *= HASH64_PRIME3;
+    return hash ^ (hash >> 32);
+}
+
+size_t run_encode(const uint8_t* src, const uint8_t* ref, size_t count, uint8_t* out)
+{
+    uint8_t* start = out;
+    size_t i = 0;
+    while (i < count)
+    {
+        // Bytes unchanged from the reference.
+        size_t n = 0;
+        while (i + n < count && n < RUN_COPY_MAX && src[i + n] == ref[i + n])
+            n++;
+        if (n > 0)
+        {
+            *out++ = RUN_COPY | (uint8_t)(n - 1);
+            i += n;
+            continue;
+        }
+
+        // Bytes of the same value. Anything shorter than three is cheaper as literals.
+        n = 1;
+        while (i + n < count && n < RUN_FILL_MAX && src[i + n] == src[i])
+            n++;
+        if (n >= 3)
+        {
+            *out++ = RUN_FILL | (uint8_t)(n - 1);
+            *out++ = src[i];
+            i += n;
+            continue;
+        }
+
+        // Literal bytes, up until either of the above runs would start.
+        uint8_t* introducer = out++;
+        n = 0;
+        do
+        {
+            *out++ = src[i++];
+            n++;
+        } while (i < count && n < RUN_LITERAL_MAX && src[i] != ref[i]
+            && !(i + 2 < count && src[i] == src[i + 1] && src[i] == src[i + 2]));
+        *introducer = RUN_LITERAL | (uint8_t)(n - 1);
+    }
+    return out - start;
+}
+
+size_t run_decode(const uint8_t* in, size_t size, const uint8_t* ref, size_t count, uint8_t* dst)
+{
+    const uint8_t* start = in;
+    const uint8_t* end = in + size;
+    size_t i = 0;
+    while (i < count)
+    {
+        // Fetch the introducer.
+        if (in == end)
+            return 0;
+        uint8_t introducer = *in++;
+        size_t n = (introducer & ((introducer & RUN_LITERAL) ? 0x7F : 0x3F)) + 1;
+        if (i + n > count)
+            return 0;
+
+        // Decode the run.
+        if (introducer & RUN_LITERAL)
+        {
+            if ((size_t)(end - in) < n)
+                return 0;
+            memcpy(&dst[i], in, n);
+            in += n;
+        }
+        else if (introducer & RUN_FILL)
+        {
+            if (in == end)
+                return 0;
+            memset(&dst[i], *in++, n);
+        }
+        else if (dst != ref)
+            memcpy(&dst[i], &ref[i], n);
+        i += n;
+    }
+    return in - start;
+}
+
+void sleep_until_ns(uint64_t timestamp)
+{
+    // Sleep for the bulk of the interval.
+    uint64_t now = get_ns_timestamp();
+    while (now + SPIN_THRESHOLD < timestamp)
+    {
+        uint64_t interval = timestamp - now - SPIN_THRESHOLD;
+#if defined(_WIN32)
+        DWORD ms = (DWORD)(interval / 1000000);
+        if (ms == 0)
+            break;
+        Sleep(ms);
+#elif defined(POSIX)
+        struct timespec request = {(time_t)(interval / NANOSECOND), (long)(interval % NANOSECOND)};
+        nanosleep(&request, NULL);
+#else
+        break;
+#endif
+        now = get_ns_timestamp();
+    }
+
+    // Spin out the rest.
+    while (get_ns_timestamp() < timestamp)
+        continue;
+}
+
+const void* map_file(const char* path, size_t* size)
+{
+#if defined(_WIN32)
+    // Map a view of the whole file. The view keeps the file mapped once the handles
+    // are closed.
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 
+        FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return NULL;
+    LARGE_INTEGER file_size;
+    HANDLE mapping = NULL;
+    const void* data = NULL;
+    if (GetFileSizeEx(file, &file_size) && file_size.QuadPart > 0 
+        && (uint64_t)file_size.QuadPart <= SIZE_MAX
+        && (mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL)) != NULL)
+    {
+        data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        *size = (size_t)file_size.QuadPart;
+    }
+    if (mapping)
+        CloseHandle(mapping);
+    CloseHandle(file);
+    return data;
+#elif defined(POSIX)
+    // Map the whole file. The mapping stays valid once the descriptor is closed.
+    int file = open(path, O_RDONLY);
+    if (file < 0)
+        return NULL;
+    struct stat info;
+    void* data = NULL;
+    if (fstat(file, &info) == 0 && info.st_size > 0)
+    {
+        data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+        if (data == MAP_FAILED)
+            data = NULL;
+        *size = (size_t)info.st_size;
+    }
+    close(file);
+    return data;
+#endif
+
+    fprintf(stderr, "map_file(): target platform is not supported\n");
+    return NULL;
+}
+
+void unmap_file(const void* data, size_t size)
+{
+    if (data == NULL)
+        return;
+#if defined(_WIN32)
+    UnmapViewOfFile(data);
+#elif defined(POSIX)
+    munmap((void*)data, size);
+#endif
 }
\ No newline at end of file
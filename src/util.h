@@ -13,8 +13,20 @@
 #define POSIX
 #endif
 
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
 #define NANOSECOND 1000000000ULL
 
+// Return the smaller/larger of two values.
+#ifndef min
+#define min(a, b) (((a) < (b)) ? (a) : (b))
+#endif
+#ifndef max
+#define max(a, b) (((a) > (b)) ? (a) : (b))
+#endif
+
 // calloc() which aborts if calloc() returns NULL.
 void* safe_calloc(size_t count, size_t size);
 
@@ -24,9 +36,45 @@ inline void* safe_malloc(size_t size)
     return safe_calloc(1, size);
 }
 
-// Get a timestamp using the system's high-resolution clock in nanoseconds.
+// Get a timestamp using the system's high-resolution monotonic clock in nanoseconds.
 uint64_t get_ns_timestamp();
 
+// Sleep until get_ns_timestamp() reaches the given timestamp. Most of the interval is
+// spent asleep; only the last stretch is spun out, to make up for the OS scheduler's
+// coarse wake-up granularity.
+void sleep_until_ns(uint64_t timestamp);
+
+// Compute the CRC-32 (IEEE 802.3) of a buffer. Pass the previous result as crc to
+// continue a running checksum, or 0 to start a new one.
+uint32_t crc32(uint32_t crc, const void* data, size_t size);
+
+// Hash a buffer into 64 bits, eight bytes at a time. This is fast rather than
+// cryptographic; different seeds give unrelated hashes of the same data.
+uint64_t hash64(uint64_t seed, const void* data, size_t size);
+
+// Worst case size of count bytes coded by run_encode(): single literal bytes
+// alternating with single unchanged bytes take 3 bytes per 2.
+#define RUN_CODED_MAX_SIZE(count)   ((count) * 3 / 2 + 2)
+
+// Code a buffer as runs against a reference buffer of the same size, returning the
+// number of bytes written to out. A run is introduced by a byte:
+// - 00nnnnnn: n + 1 bytes are the same as in the reference.
+// - 01nnnnnn: n + 1 bytes are all the value of the next byte.
+// - 1nnnnnnn: n + 1 literal bytes follow.
+size_t run_encode(const uint8_t* src, const uint8_t* ref, size_t count, uint8_t* out);
+
+// Decode runs coded by run_encode() against the same reference; dst may be the
+// reference itself. Returns the number of coded bytes read, or 0 if the coded data
+// is corrupt.
+size_t run_decode(const uint8_t* in, size_t size, const uint8_t* ref, size_t count, uint8_t* dst);
+
+// Map a whole file into memory, read-only, and store its size. Returns NULL on
+// failure, or if the file is empty.
+const void* map_file(const char* path, size_t* size);
+
+// Unmap a file mapped by map_file().
+void unmap_file(const void* data, size_t size);
+
 // Linearly interpolate from a to b using weight t.
 inline float lerp(float a, float b, float t)
 {
@@ -37,4 +85,87 @@ inline float lerp(float a, float b, float t)
 inline uint8_t reverse_byte(uint8_t byte)
 {
     return (byte * 0x0202020202ULL & 0x010884422010ULL) % 1023;
+}
+
+// Atomically load a 32-bit value (acquire semantics). Used by lock-free structures
+// shared between the emulation thread and other threads.
+inline uint32_t atomic_load_u32(volatile uint32_t* ptr)
+{
+#if defined(_MSC_VER)
+    return (uint32_t)_InterlockedOr((volatile long*)ptr, 0);
+#else
+    return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+#endif
+}
+
+// Atomically store a 32-bit value (release semantics).
+inline void atomic_store_u32(volatile uint32_t* ptr, uint32_t value)
+{
+#if defined(_MSC_VER)
+    _InterlockedExchange((volatile long*)ptr, (long)value);
+#else
+    __atomic_store_n(ptr, value, __ATOMIC_RELEASE);
+#endif
+}
+
+// Atomically add to a 32-bit value, returning the previous value.
+inline uint32_t atomic_add_u32(volatile uint32_t* ptr, uint32_t value)
+{
+#if defined(_MSC_VER)
+    return (uint32_t)_InterlockedExchangeAdd((volatile long*)ptr, (long)value);
+#else
+    return __atomic_fetch_add(ptr, value, __ATOMIC_ACQ_REL);
+#endif
+}
+
+// Atomically exchange a 32-bit value, returning the previous value.
+inline uint32_t atomic_exchange_u32(volatile uint32_t* ptr, uint32_t value)
+{
+#if defined(_MSC_VER)
+    return (uint32_t)_InterlockedExchange((volatile long*)ptr, (long)value);
+#else
+    return __atomic_exchange_n(ptr, value, __ATOMIC_ACQ_REL);
+#endif
+}
+
+// Atomically load a 64-bit value (acquire semantics).
+inline uint64_t atomic_load_u64(volatile uint64_t* ptr)
+{
+#if defined(_MSC_VER)
+    return (uint64_t)_InterlockedOr64((volatile long long*)ptr, 0);
+#else
+    return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+#endif
+}
+
+// Atomically store a 64-bit value (release semantics).
+inline void atomic_store_u64(volatile uint64_t* ptr, uint64_t value)
+{
+#if defined(_MSC_VER)
+    _InterlockedExchange64((volatile long long*)ptr, (long long)value);
+#else
+    __atomic_store_n(ptr, value, __ATOMIC_RELEASE);
+#endif
+}
+
+// Atomically replace a 64-bit value with another if it holds the expected one.
+// Returns the value it held, which equals expected if it was replaced.
+inline uint64_t atomic_cas_u64(volatile uint64_t* ptr, uint64_t expected, uint64_t value)
+{
+#if defined(_MSC_VER)
+    return (uint64_t)_InterlockedCompareExchange64((volatile long long*)ptr, (long long)value, (long long)expected);
+#else
+    __atomic_compare_exchange_n(ptr, &expected, value, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+    return expected;
+#endif
+}
+
+// Full memory barrier: no load or store is moved across it either way.
+inline void atomic_fence()
+{
+#if defined(_MSC_VER)
+    _mm_mfence();
+#else
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+#endif
 }
\ No newline at end of file